@@ -0,0 +1,338 @@
+/*
+ * Runs a replay camera (see gphoto-replay.c) through the same device code as a preview source:
+ * fetch thread, repeated frame filter, pacing, ring, decode threads and in order output. Reports
+ * throughput, latency, duplicates, allocations and CPU time.
+ *
+ * usage: obs-gphoto-bench <replay directory> [options]
+ *        obs-gphoto-bench --check
+ *   --frames N      output frames to wait for (default 300)
+ *   --fps F         the source's frame rate limit (default 60), camera.json sets the camera's
+ *   --pacing P      latency or smooth (default latency)
+ *   --depth D       decode threads (default 1)
+ *   --scale S       JPEG DCT scale denominator, 1, 2, 4 or 8 (default 1)
+ *   --format F      bgrx or i420 (default bgrx)
+ *   --scalar        use the scalar colour conversion kernels, with libjpeg-turbo only I420 output runs them
+ *
+ * --check compares this CPU's colour conversion kernels with the scalar reference and fails on any difference.
+ *
+ * With OBS_GPHOTO_TRACE=<file.json> set the fetch, decode and output spans are written as a trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <obs-module.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+
+#include "gphoto-backend.h"
+#include "gphoto-convert.h"
+#include "gphoto-device.h"
+#include "gphoto-discovery.h"
+#include "gphoto-replay.h"
+#include "gphoto-sizes.h"
+#include "gphoto-trace.h"
+
+/* The replay cameras show up with the first scan, which runs in the background. */
+#define BENCH_DISCOVERY_TIMEOUT 5000000000ULL
+
+/* The shared sources are written for a module, the benchmark has no locale to look texts up in. */
+const char *obs_module_text(const char *lookup_string) {
+    return lookup_string;
+}
+
+/* No config directory either, every run probes the live view size like a camera seen the first time. */
+char *obs_module_config_path(const char *file) {
+    UNUSED_PARAMETER(file);
+    return NULL;
+}
+
+struct bench {
+    pthread_mutex_t mutex;
+
+    uint64_t *latencies;
+    size_t outputs;
+    size_t capacity;
+    uint64_t last_output;
+};
+
+static void bench_output(void *param, struct obs_source_frame *frame) {
+    struct bench *bench = param;
+    uint64_t now = os_gettime_ns();
+
+    pthread_mutex_lock(&bench->mutex);
+    if (bench->outputs < bench->capacity) {
+        bench->latencies[bench->outputs] = now > frame->timestamp ? now - frame->timestamp : 0;
+    }
+    bench->outputs++;
+    bench->last_output = now;
+    pthread_mutex_unlock(&bench->mutex);
+}
+
+/* Every row length up to a few vector widths, so each tail path runs. Outputs are poisoned to catch overruns. */
+#define CHECK_PIXELS 200
+
+static bool check_buffers(const uint8_t *a, const uint8_t *b, size_t size, const char *kernel, size_t pixels) {
+    if (memcmp(a, b, size) != 0) {
+        fprintf(stderr, "%s %s differs from the scalar reference for %zu pixels\n", gphoto_convert->name, kernel,
+                pixels);
+        return false;
+    }
+    return true;
+}
+
+static int check_kernels(void) {
+    const struct gphoto_convert_kernels *reference = gphoto_convert_reference();
+    uint8_t rows[2][CHECK_PIXELS * 3], out[2][4][CHECK_PIXELS], expected[2][4][CHECK_PIXELS];
+    uint8_t packed[CHECK_PIXELS * 4], packed_expected[CHECK_PIXELS * 4];
+    size_t pixels, i, k;
+    bool ok = true;
+
+    gphoto_convert_init();
+    srand(1);
+    for (pixels = 1; pixels <= CHECK_PIXELS && ok; pixels++) {
+        for (i = 0; i < sizeof(rows); i++) {
+            rows[i / sizeof(rows[0])][i % sizeof(rows[0])] = (uint8_t)rand();
+        }
+        memset(out, 0xA5, sizeof(out));
+        memset(expected, 0xA5, sizeof(expected));
+
+        reference->ycbcr_to_i420(rows[0], rows[1], expected[0][0], expected[0][1], expected[0][2], expected[0][3],
+                                 pixels);
+        gphoto_convert->ycbcr_to_i420(rows[0], rows[1], out[0][0], out[0][1], out[0][2], out[0][3], pixels);
+        ok = check_buffers(out[0][0], expected[0][0], sizeof(out[0]), "ycbcr_to_i420", pixels);
+
+        k = pixels * 3 > CHECK_PIXELS ? CHECK_PIXELS : pixels * 3;
+        reference->average_rows(expected[1][0], rows[0], rows[1], k);
+        gphoto_convert->average_rows(out[1][0], rows[0], rows[1], k);
+        ok = ok && check_buffers(out[1][0], expected[1][0], sizeof(out[1]), "average_rows", k);
+
+        memset(packed, 0xA5, sizeof(packed));
+        memset(packed_expected, 0xA5, sizeof(packed_expected));
+        reference->ycbcr_to_bgrx(rows[0], packed_expected, pixels);
+        gphoto_convert->ycbcr_to_bgrx(rows[0], packed, pixels);
+        ok = ok && check_buffers(packed, packed_expected, sizeof(packed), "ycbcr_to_bgrx", pixels);
+
+        reference->rgb_to_bgra(rows[1], packed_expected, pixels);
+        gphoto_convert->rgb_to_bgra(rows[1], packed, pixels);
+        ok = ok && check_buffers(packed, packed_expected, sizeof(packed), "rgb_to_bgra", pixels);
+
+        memcpy(packed_expected, rows[0], pixels * 3);
+        memcpy(packed, rows[0], pixels * 3);
+        reference->fill_alpha(packed_expected, pixels * 3 / 4);
+        gphoto_convert->fill_alpha(packed, pixels * 3 / 4);
+        ok = ok && check_buffers(packed, packed_expected, sizeof(packed), "fill_alpha", pixels * 3 / 4);
+    }
+    if (ok) {
+        printf("%s kernels match the scalar reference\n", gphoto_convert->name);
+    }
+    return ok ? 0 : 1;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double percentile_ms(const uint64_t *sorted, size_t count, double p) {
+    size_t index = (size_t)(p / 100.0 * (double)(count - 1) + 0.5);
+    return (double)sorted[index] / 1000000.0;
+}
+
+static double cpu_seconds(void) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1000000.0 +
+           (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1000000.0;
+}
+
+/* Picks the first replay camera, the way a source picks its model. */
+static bool bench_find_camera(struct dstr *model) {
+    uint64_t deadline = os_gettime_ns() + BENCH_DISCOVERY_TIMEOUT;
+    CameraList *cameras = NULL;
+    const char *name;
+    bool found = false;
+
+    gp_list_new(&cameras);
+    while (!found && os_gettime_ns() < deadline) {
+        gphoto_discovery_list(cameras);
+        found = gp_list_count(cameras) > 0;
+        if (found) {
+            gp_list_get_name(cameras, 0, &name);
+            dstr_copy(model, name);
+        } else {
+            os_sleep_ms(10);
+        }
+    }
+    gp_list_free(cameras);
+    return found;
+}
+
+int main(int argc, char **argv) {
+    struct gphoto_device *device = NULL;
+    struct gphoto_viewer viewer = {0};
+    struct bench bench = {0};
+    struct dstr model = {0};
+    struct dstr stages = {0};
+    enum video_format format = VIDEO_FORMAT_BGRX;
+    enum preview_pacing pacing = PREVIEW_PACING_LATENCY;
+    size_t frames = 300, depth = 1, i, count;
+    uint32_t scale = 1;
+    long long fps = 60;
+    double cpu_start, cpu_end, wall;
+    uint64_t start, end, fetched, duplicates, dropped = 0;
+    long allocs_start, buffer_allocs = 0;
+    bool scalar = false;
+    int ret = 1;
+
+    if (argc == 2 && strcmp(argv[1], "--check") == 0) {
+        return check_kernels();
+    }
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <replay directory> [--frames N] [--fps F] [--pacing latency|smooth] "
+                        "[--depth D] [--scale S] [--format bgrx|i420] [--scalar]\n       %s --check\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    for (i = 2; i < (size_t)argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < (size_t)argc) {
+            frames = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < (size_t)argc) {
+            fps = strtoll(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < (size_t)argc) {
+            pacing = strcmp(argv[++i], "smooth") == 0 ? PREVIEW_PACING_SMOOTH : PREVIEW_PACING_LATENCY;
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < (size_t)argc) {
+            depth = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < (size_t)argc) {
+            scale = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < (size_t)argc) {
+            format = strcmp(argv[++i], "i420") == 0 ? VIDEO_FORMAT_I420 : VIDEO_FORMAT_BGRX;
+        } else if (strcmp(argv[i], "--scalar") == 0) {
+            scalar = true;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (!frames || depth < 1 || (scale != 1 && scale != 2 && scale != 4 && scale != 8)) {
+        fprintf(stderr, "Invalid frames, depth or scale\n");
+        return 2;
+    }
+
+    /* The same start up as the module, with every camera replaced by the recording. */
+    setenv("OBS_GPHOTO_REPLAY", argv[1], 1);
+    gphoto_trace_init();
+    gphoto_convert_init();
+    if (scalar) {
+        gphoto_convert = gphoto_convert_reference();
+    }
+    gphoto_backend_init();
+    if (gphoto_backend_get() != gphoto_replay_backend()) {
+        fprintf(stderr, "No replay recording in %s\n", argv[1]);
+        gphoto_backend_free();
+        gphoto_trace_free();
+        return 1;
+    }
+    gphoto_sizes_load();
+    gphoto_discovery_init();
+    gphoto_devices_init();
+
+    pthread_mutex_init(&bench.mutex, NULL);
+    bench.capacity = frames;
+    bench.latencies = bzalloc(frames * sizeof(uint64_t));
+
+    if (!bench_find_camera(&model)) {
+        fprintf(stderr, "The replay camera didn't show up\n");
+        goto exit;
+    }
+    device = gphoto_device_open(model.array);
+    if (!device) {
+        fprintf(stderr, "Can't open %s\n", model.array);
+        goto exit;
+    }
+
+    viewer.output = bench_output;
+    viewer.param = &bench;
+    viewer.format = format;
+    viewer.scale = scale;
+    viewer.depth = depth;
+    viewer.fps = fps;
+    viewer.pacing = pacing;
+
+    allocs_start = bnum_allocs();
+    cpu_start = cpu_seconds();
+    start = os_gettime_ns();
+    if (!gphoto_device_watch(device, &viewer)) {
+        fprintf(stderr, "Can't start the live view of %s\n", model.array);
+        goto exit;
+    }
+
+    /* Until enough frames came out, or none did for a second. */
+    while (true) {
+        pthread_mutex_lock(&bench.mutex);
+        count = bench.outputs;
+        end = bench.outputs ? bench.last_output : start;
+        pthread_mutex_unlock(&bench.mutex);
+        if (count >= frames || os_gettime_ns() - end > 1000000000ULL) {
+            break;
+        }
+        os_sleep_ms(1);
+    }
+
+    /* Read before the group and its session go away with the last viewer. */
+    pthread_mutex_lock(&device->viewers_mutex);
+    dropped = viewer.group->session.ring.dropped;
+    buffer_allocs = preview_session_buffer_allocs(&viewer.group->session);
+    pthread_mutex_unlock(&device->viewers_mutex);
+    gphoto_device_unwatch(device, &viewer);
+    cpu_end = cpu_seconds();
+
+    /* Safe to read once the fetch thread was joined. */
+    fetched = device->fetch.fetched;
+    duplicates = device->fetch.duplicates;
+    pthread_mutex_lock(&bench.mutex);
+    end = bench.outputs ? bench.last_output : os_gettime_ns();
+    count = bench.outputs < bench.capacity ? bench.outputs : bench.capacity;
+    pthread_mutex_unlock(&bench.mutex);
+
+    wall = (double)(end - start) / 1000000000.0;
+    printf("input        %s, live view %ux%u, output %ux%u %s, scale 1/%u, %zu decode threads, %s kernels\n",
+           model.array, device->lv_width, device->lv_height, viewer.width, viewer.height,
+           format == VIDEO_FORMAT_I420 ? "I420" : "BGRX", scale, depth, gphoto_convert->name);
+    printf("pacing       %s, at most %lld fps\n", pacing == PREVIEW_PACING_SMOOTH ? "smooth" : "latency", fps);
+    printf("fetches      %llu, %llu repeated frames skipped\n", (unsigned long long)fetched,
+           (unsigned long long)duplicates);
+    printf("frames       %zu output, %llu dropped in %.3f s\n", bench.outputs, (unsigned long long)dropped, wall);
+    printf("throughput   %.1f fps\n", wall > 0.0 ? (double)bench.outputs / wall : 0.0);
+    if (count) {
+        qsort(bench.latencies, count, sizeof(uint64_t), compare_u64);
+        printf("latency ms   p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n", percentile_ms(bench.latencies, count, 50),
+               percentile_ms(bench.latencies, count, 90), percentile_ms(bench.latencies, count, 99),
+               percentile_ms(bench.latencies, count, 100));
+    }
+    gphoto_stats_print(&device->stats, &stages);
+    printf("stages\n%s", stages.array);
+    dstr_free(&stages);
+    /* libjpeg and libgphoto2 use malloc, neither number covers them. */
+    printf("allocations  %ld plugin buffer allocations, %ld live bmalloc blocks at end of run\n", buffer_allocs,
+           bnum_allocs() - allocs_start);
+    printf("cpu          %.3f s (%.1f%% of one core, %.2f ms per frame)\n", cpu_end - cpu_start,
+           wall > 0.0 ? 100.0 * (cpu_end - cpu_start) / wall : 0.0,
+           bench.outputs ? 1000.0 * (cpu_end - cpu_start) / (double)bench.outputs : 0.0);
+    ret = bench.outputs ? 0 : 1;
+
+    exit:
+    if (device) {
+        gphoto_device_close(device);
+    }
+    gphoto_devices_free();
+    gphoto_discovery_free();
+    gphoto_sizes_free();
+    gphoto_backend_free();
+    gphoto_trace_free();
+    dstr_free(&model);
+    bfree(bench.latencies);
+    pthread_mutex_destroy(&bench.mutex);
+    return ret;
+}
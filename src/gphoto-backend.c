@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <obs-module.h>
+
+#include "gphoto-backend.h"
+#include "gphoto-registry.h"
+#include "gphoto-replay.h"
+
+struct gphoto_camera {
+    const struct gphoto_backend *backend;
+    void *impl;
+};
+
+/* Drivers come from the shared registry, a model or port lookup doesn't scan the camlibs again. */
+static int libgphoto2_open_camera(Camera **camera, const char *model, const char *port) {
+    CameraAbilities abilities;
+    GPPortInfo info;
+    int ret;
+
+    ret = gphoto_registry_abilities(model, &abilities);
+    if (ret < GP_OK) return ret;
+    ret = gphoto_registry_port_info(port, &info);
+    if (ret < GP_OK) return ret;
+
+    ret = gp_camera_new(camera);
+    if (ret < GP_OK) return ret;
+    ret = gp_camera_set_abilities(*camera, abilities);
+    if (ret < GP_OK) return ret;
+    return gp_camera_set_port_info(*camera, info);
+}
+
+static int libgphoto2_autodetect(CameraList *list, GPContext *context) {
+    return gphoto_registry_detect(list, context);
+}
+
+static int libgphoto2_open(void **impl, const char *model, const char *port, GPContext *context) {
+    UNUSED_PARAMETER(context);
+    return libgphoto2_open_camera((Camera **)impl, model, port);
+}
+
+static int libgphoto2_init(void *impl, GPContext *context) {
+    return gp_camera_init(impl, context);
+}
+
+static int libgphoto2_exit(void *impl, GPContext *context) {
+    return gp_camera_exit(impl, context);
+}
+
+static void libgphoto2_free(void *impl) {
+    gp_camera_free(impl);
+}
+
+static int libgphoto2_capture_preview(void *impl, CameraFile *file, GPContext *context) {
+    return gp_camera_capture_preview(impl, file, context);
+}
+
+static int libgphoto2_capture(void *impl, CameraCaptureType type, CameraFilePath *path, GPContext *context) {
+    return gp_camera_capture(impl, type, path, context);
+}
+
+static int libgphoto2_file_get(void *impl, const char *folder, const char *name, CameraFileType type,
+                               CameraFile *file, GPContext *context) {
+    return gp_camera_file_get(impl, folder, name, type, file, context);
+}
+
+static int libgphoto2_file_delete(void *impl, const char *folder, const char *name, GPContext *context) {
+    return gp_camera_file_delete(impl, folder, name, context);
+}
+
+static int libgphoto2_wait_for_event(void *impl, int timeout, CameraEventType *type, void **data,
+                                     GPContext *context) {
+    return gp_camera_wait_for_event(impl, timeout, type, data, context);
+}
+
+static int libgphoto2_get_config(void *impl, CameraWidget **window, GPContext *context) {
+    return gp_camera_get_config(impl, window, context);
+}
+
+static int libgphoto2_set_config(void *impl, CameraWidget *window, GPContext *context) {
+    return gp_camera_set_config(impl, window, context);
+}
+
+static int libgphoto2_get_single_config(void *impl, const char *name, CameraWidget **widget, GPContext *context) {
+    return gp_camera_get_single_config(impl, name, widget, context);
+}
+
+static int libgphoto2_set_single_config(void *impl, const char *name, CameraWidget *widget, GPContext *context) {
+    return gp_camera_set_single_config(impl, name, widget, context);
+}
+
+static const struct gphoto_backend libgphoto2_backend = {
+    .name = "libgphoto2",
+    .autodetect = libgphoto2_autodetect,
+    .open = libgphoto2_open,
+    .init = libgphoto2_init,
+    .exit = libgphoto2_exit,
+    .free = libgphoto2_free,
+    .capture_preview = libgphoto2_capture_preview,
+    .capture = libgphoto2_capture,
+    .file_get = libgphoto2_file_get,
+    .file_delete = libgphoto2_file_delete,
+    .wait_for_event = libgphoto2_wait_for_event,
+    .get_config = libgphoto2_get_config,
+    .set_config = libgphoto2_set_config,
+    .get_single_config = libgphoto2_get_single_config,
+    .set_single_config = libgphoto2_set_single_config,
+};
+
+static const struct gphoto_backend *backend = &libgphoto2_backend;
+
+/* OBS_GPHOTO_REPLAY=<directory> swaps every camera for recorded ones, see gphoto-replay.c. */
+void gphoto_backend_init(void) {
+    const char *replay_dir = getenv("OBS_GPHOTO_REPLAY");
+
+    if (replay_dir && *replay_dir) {
+        if (gphoto_replay_load(replay_dir)) {
+            backend = gphoto_replay_backend();
+        } else {
+            blog(LOG_WARNING, "Can't load replay cameras from %s.\n", replay_dir);
+        }
+    }
+    blog(LOG_INFO, "Camera backend: %s.\n", backend->name);
+    if (backend == &libgphoto2_backend) {
+        gphoto_registry_warm();
+    }
+}
+
+void gphoto_backend_free(void) {
+    gphoto_registry_free();
+    gphoto_replay_unload();
+    backend = &libgphoto2_backend;
+}
+
+const struct gphoto_backend *gphoto_backend_get(void) {
+    return backend;
+}
+
+int gphoto_camera_autodetect(CameraList *list, GPContext *context) {
+    return backend->autodetect(list, context);
+}
+
+int gphoto_camera_open(struct gphoto_camera **camera, const char *model, const char *port, GPContext *context) {
+    *camera = bzalloc(sizeof(struct gphoto_camera));
+    (*camera)->backend = backend;
+    return backend->open(&(*camera)->impl, model, port, context);
+}
+
+int gphoto_camera_init(struct gphoto_camera *camera, GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->init(camera->impl, context);
+}
+
+int gphoto_camera_exit(struct gphoto_camera *camera, GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->exit(camera->impl, context);
+}
+
+void gphoto_camera_free(struct gphoto_camera *camera) {
+    if (camera) {
+        if (camera->impl) {
+            camera->backend->free(camera->impl);
+        }
+        bfree(camera);
+    }
+}
+
+int gphoto_camera_capture_preview(struct gphoto_camera *camera, CameraFile *file, GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->capture_preview(camera->impl, file, context);
+}
+
+int gphoto_camera_capture(struct gphoto_camera *camera, CameraCaptureType type, CameraFilePath *path,
+                          GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->capture(camera->impl, type, path, context);
+}
+
+int gphoto_camera_file_get(struct gphoto_camera *camera, const char *folder, const char *name, CameraFileType type,
+                           CameraFile *file, GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->file_get(camera->impl, folder, name, type, file, context);
+}
+
+int gphoto_camera_file_delete(struct gphoto_camera *camera, const char *folder, const char *name,
+                              GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->file_delete(camera->impl, folder, name, context);
+}
+
+int gphoto_camera_wait_for_event(struct gphoto_camera *camera, int timeout, CameraEventType *type, void **data,
+                                 GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->wait_for_event(camera->impl, timeout, type, data, context);
+}
+
+int gphoto_camera_get_config(struct gphoto_camera *camera, CameraWidget **window, GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->get_config(camera->impl, window, context);
+}
+
+int gphoto_camera_set_config(struct gphoto_camera *camera, CameraWidget *window, GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->set_config(camera->impl, window, context);
+}
+
+int gphoto_camera_get_single_config(struct gphoto_camera *camera, const char *name, CameraWidget **widget,
+                                    GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->get_single_config(camera->impl, name, widget, context);
+}
+
+int gphoto_camera_set_single_config(struct gphoto_camera *camera, const char *name, CameraWidget *widget,
+                                    GPContext *context) {
+    if (!camera || !camera->impl) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    return camera->backend->set_single_config(camera->impl, name, widget, context);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <gphoto2/gphoto2-camera.h>
+
+/*
+ * Everything the sources need from a camera. The libgphoto2 backend forwards to gp_camera_*, the
+ * replay backend (gphoto-replay.c) serves recorded files instead. The backend is chosen once at
+ * module load.
+ */
+struct gphoto_backend {
+    const char *name;
+
+    int (*autodetect)(CameraList *list, GPContext *context);
+    int (*open)(void **impl, const char *model, const char *port, GPContext *context);
+    int (*init)(void *impl, GPContext *context);
+    int (*exit)(void *impl, GPContext *context);
+    void (*free)(void *impl);
+
+    int (*capture_preview)(void *impl, CameraFile *file, GPContext *context);
+    int (*capture)(void *impl, CameraCaptureType type, CameraFilePath *path, GPContext *context);
+    int (*file_get)(void *impl, const char *folder, const char *name, CameraFileType type, CameraFile *file,
+                    GPContext *context);
+    int (*file_delete)(void *impl, const char *folder, const char *name, GPContext *context);
+    int (*wait_for_event)(void *impl, int timeout, CameraEventType *type, void **data, GPContext *context);
+
+    int (*get_config)(void *impl, CameraWidget **window, GPContext *context);
+    int (*set_config)(void *impl, CameraWidget *window, GPContext *context);
+    int (*get_single_config)(void *impl, const char *name, CameraWidget **widget, GPContext *context);
+    int (*set_single_config)(void *impl, const char *name, CameraWidget *widget, GPContext *context);
+};
+
+struct gphoto_camera;
+
+void gphoto_backend_init(void);
+void gphoto_backend_free(void);
+const struct gphoto_backend *gphoto_backend_get(void);
+
+int gphoto_camera_autodetect(CameraList *list, GPContext *context);
+int gphoto_camera_open(struct gphoto_camera **camera, const char *model, const char *port, GPContext *context);
+int gphoto_camera_init(struct gphoto_camera *camera, GPContext *context);
+int gphoto_camera_exit(struct gphoto_camera *camera, GPContext *context);
+void gphoto_camera_free(struct gphoto_camera *camera);
+
+int gphoto_camera_capture_preview(struct gphoto_camera *camera, CameraFile *file, GPContext *context);
+int gphoto_camera_capture(struct gphoto_camera *camera, CameraCaptureType type, CameraFilePath *path,
+                          GPContext *context);
+int gphoto_camera_file_get(struct gphoto_camera *camera, const char *folder, const char *name, CameraFileType type,
+                           CameraFile *file, GPContext *context);
+int gphoto_camera_file_delete(struct gphoto_camera *camera, const char *folder, const char *name,
+                              GPContext *context);
+int gphoto_camera_wait_for_event(struct gphoto_camera *camera, int timeout, CameraEventType *type, void **data,
+                                 GPContext *context);
+
+int gphoto_camera_get_config(struct gphoto_camera *camera, CameraWidget **window, GPContext *context);
+int gphoto_camera_set_config(struct gphoto_camera *camera, CameraWidget *window, GPContext *context);
+int gphoto_camera_get_single_config(struct gphoto_camera *camera, const char *name, CameraWidget **widget,
+                                    GPContext *context);
+int gphoto_camera_set_single_config(struct gphoto_camera *camera, const char *name, CameraWidget *widget,
+                                    GPContext *context);
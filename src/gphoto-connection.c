@@ -0,0 +1,271 @@
+#include <time.h>
+#include <util/platform.h>
+
+#include "gphoto-connection.h"
+#include "gphoto-trace.h"
+
+#define GPHOTO_CONNECT_ATTEMPTS 8
+#define GPHOTO_CONNECT_RETRY_MIN 1000000000ULL
+#define GPHOTO_CONNECT_RETRY_MAX 30000000000ULL
+
+static const char *state_names[] = {"idle", "connecting", "streaming", "retrying", "failed", "closing"};
+
+const char *gphoto_connection_state_name(enum gphoto_connection_state state) {
+    return state_names[state];
+}
+
+/* Called with the mutex held. */
+static void connection_set_state(struct gphoto_connection *connection, enum gphoto_connection_state state) {
+    if (connection->state != state) {
+        blog(LOG_INFO, "%s: camera %s.\n", obs_source_get_name(connection->source), state_names[state]);
+        __atomic_store_n(&connection->state, state, __ATOMIC_RELEASE);
+    }
+}
+
+/* The condition variable runs on CLOCK_MONOTONIC, the clock behind os_gettime_ns. */
+static void connection_wait_until(struct gphoto_connection *connection, uint64_t deadline) {
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(deadline / 1000000000ULL);
+    ts.tv_nsec = (long)(deadline % 1000000000ULL);
+    pthread_cond_timedwait(&connection->cond, &connection->mutex, &ts);
+}
+
+static uint64_t connection_backoff(uint32_t attempts) {
+    uint64_t delay = GPHOTO_CONNECT_RETRY_MIN << (attempts > 5 ? 5 : attempts - 1);
+    return delay < GPHOTO_CONNECT_RETRY_MAX ? delay : GPHOTO_CONNECT_RETRY_MAX;
+}
+
+static void connection_disconnect(struct gphoto_connection *connection) {
+    connection_set_state(connection, GPHOTO_CONNECTION_CLOSING);
+    pthread_mutex_unlock(&connection->mutex);
+    connection->disconnect(connection->param);
+    pthread_mutex_lock(&connection->mutex);
+    connection->connected = false;
+    connection_set_state(connection, GPHOTO_CONNECTION_IDLE);
+}
+
+static void connection_connect(struct gphoto_connection *connection) {
+    uint64_t generation = connection->generation;
+    uint64_t span;
+    bool connected;
+
+    connection_set_state(connection, GPHOTO_CONNECTION_CONNECTING);
+    /* connect reads the current settings, a refresh asked for from now on runs after it. */
+    connection->refresh_wanted = false;
+    pthread_mutex_unlock(&connection->mutex);
+    span = gphoto_trace_now();
+    connected = connection->connect(connection->param);
+    if (!connected) {
+        connection->disconnect(connection->param);
+    }
+    gphoto_trace_end("connect", span);
+    pthread_mutex_lock(&connection->mutex);
+
+    if (connected) {
+        connection->connected = true;
+        connection->connected_generation = generation;
+        connection->attempts = 0;
+        connection_set_state(connection, GPHOTO_CONNECTION_STREAMING);
+    } else if (++connection->attempts >= GPHOTO_CONNECT_ATTEMPTS) {
+        connection_set_state(connection, GPHOTO_CONNECTION_FAILED);
+    } else {
+        connection->retry_at = os_gettime_ns() + connection_backoff(connection->attempts);
+        connection_set_state(connection, GPHOTO_CONNECTION_RETRYING);
+    }
+}
+
+/* Callers outside the worker can't lock the streaming camera meanwhile. */
+static void connection_refresh(struct gphoto_connection *connection) {
+    bool refreshed;
+
+    connection->refresh_wanted = false;
+    connection_set_state(connection, GPHOTO_CONNECTION_CONNECTING);
+    pthread_mutex_unlock(&connection->mutex);
+    refreshed = connection->refresh(connection->param);
+    pthread_mutex_lock(&connection->mutex);
+
+    if (refreshed) {
+        connection_set_state(connection, GPHOTO_CONNECTION_STREAMING);
+    } else {
+        connection->generation++;
+    }
+}
+
+static void *connection_thread(void *vptr) {
+    struct gphoto_connection *connection = vptr;
+
+    gphoto_trace_thread_name("camera connection");
+    pthread_mutex_lock(&connection->mutex);
+    while (!connection->stop) {
+        if (connection->connected &&
+            (!connection->wanted || connection->connected_generation != connection->generation)) {
+            connection_disconnect(connection);
+        } else if (connection->wanted && connection->connected && connection->refresh_wanted) {
+            connection_refresh(connection);
+        } else if (!connection->wanted || connection->connected) {
+            if (!connection->connected) {
+                connection_set_state(connection, GPHOTO_CONNECTION_IDLE);
+            }
+            pthread_cond_wait(&connection->cond, &connection->mutex);
+        } else if (connection->state == GPHOTO_CONNECTION_FAILED) {
+            pthread_cond_wait(&connection->cond, &connection->mutex);
+        } else if (connection->state == GPHOTO_CONNECTION_RETRYING && os_gettime_ns() < connection->retry_at) {
+            connection_wait_until(connection, connection->retry_at);
+        } else {
+            connection_connect(connection);
+        }
+    }
+    if (connection->connected) {
+        connection_disconnect(connection);
+    }
+    pthread_mutex_unlock(&connection->mutex);
+
+    return NULL;
+}
+
+void gphoto_connection_init(struct gphoto_connection *connection, obs_source_t *source, gphoto_connect_t connect,
+                            gphoto_disconnect_t disconnect, gphoto_refresh_t refresh, void *param) {
+    pthread_condattr_t attr;
+
+    memset(connection, 0, sizeof(struct gphoto_connection));
+    connection->source = source;
+    connection->connect = connect;
+    connection->disconnect = disconnect;
+    connection->refresh = refresh;
+    connection->param = param;
+
+    pthread_mutex_init(&connection->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&connection->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_create(&connection->thread, NULL, connection_thread, connection);
+}
+
+/* Closes the camera if it is open, this one waits. */
+void gphoto_connection_free(struct gphoto_connection *connection) {
+    pthread_mutex_lock(&connection->mutex);
+    connection->stop = true;
+    pthread_cond_signal(&connection->cond);
+    pthread_mutex_unlock(&connection->mutex);
+
+    pthread_join(connection->thread, NULL);
+    pthread_cond_destroy(&connection->cond);
+    pthread_mutex_destroy(&connection->mutex);
+}
+
+/* Called with the mutex held. */
+static void connection_retry_now(struct gphoto_connection *connection) {
+    connection->attempts = 0;
+    connection->retry_at = 0;
+    if (connection->state == GPHOTO_CONNECTION_FAILED) {
+        connection_set_state(connection, GPHOTO_CONNECTION_RETRYING);
+    }
+    pthread_cond_signal(&connection->cond);
+}
+
+/* Also retries at once after a failure, an open means something changed. */
+void gphoto_connection_open(struct gphoto_connection *connection) {
+    pthread_mutex_lock(&connection->mutex);
+    connection->wanted = true;
+    if (!connection->connected) {
+        connection_retry_now(connection);
+    }
+    pthread_cond_signal(&connection->cond);
+    pthread_mutex_unlock(&connection->mutex);
+}
+
+void gphoto_connection_close(struct gphoto_connection *connection) {
+    pthread_mutex_lock(&connection->mutex);
+    connection->wanted = false;
+    pthread_cond_signal(&connection->cond);
+    pthread_mutex_unlock(&connection->mutex);
+}
+
+/* Reconnects with the current settings if the camera is wanted, e.g. after another camera was picked. */
+void gphoto_connection_restart(struct gphoto_connection *connection) {
+    pthread_mutex_lock(&connection->mutex);
+    if (connection->wanted) {
+        connection->generation++;
+        connection_retry_now(connection);
+    }
+    pthread_mutex_unlock(&connection->mutex);
+}
+
+/* Settings changed that the open camera can take without a reconnect, the caller never waits for it. */
+void gphoto_connection_refresh(struct gphoto_connection *connection) {
+    if (!connection->refresh) {
+        gphoto_connection_restart(connection);
+        return;
+    }
+    pthread_mutex_lock(&connection->mutex);
+    if (connection->wanted) {
+        connection->refresh_wanted = true;
+        pthread_cond_signal(&connection->cond);
+    }
+    pthread_mutex_unlock(&connection->mutex);
+}
+
+/* A camera appeared: a wanted connection that is waiting to retry, or gave up, tries right away. */
+void gphoto_connection_retry(struct gphoto_connection *connection) {
+    pthread_mutex_lock(&connection->mutex);
+    if (connection->wanted && !connection->connected) {
+        connection_retry_now(connection);
+    }
+    pthread_mutex_unlock(&connection->mutex);
+}
+
+enum gphoto_connection_state gphoto_connection_state(struct gphoto_connection *connection) {
+    return __atomic_load_n(&connection->state, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * For callers outside the worker that need the open camera: the worker can't start closing it
+ * until gphoto_connection_unlock. Returns false, without the lock, when the camera isn't open.
+ */
+bool gphoto_connection_lock_streaming(struct gphoto_connection *connection) {
+    pthread_mutex_lock(&connection->mutex);
+    if (connection->state != GPHOTO_CONNECTION_STREAMING) {
+        pthread_mutex_unlock(&connection->mutex);
+        return false;
+    }
+    return true;
+}
+
+void gphoto_connection_lock(struct gphoto_connection *connection) {
+    pthread_mutex_lock(&connection->mutex);
+}
+
+void gphoto_connection_unlock(struct gphoto_connection *connection) {
+    pthread_mutex_unlock(&connection->mutex);
+}
+
+/* Settings the worker reads are source owned copies, swapped under the mutex so a snapshot never dangles. */
+void gphoto_connection_set_string(struct gphoto_connection *connection, char **field, const char *value) {
+    char *old;
+
+    pthread_mutex_lock(&connection->mutex);
+    old = *field;
+    *field = bstrdup(value);
+    pthread_mutex_unlock(&connection->mutex);
+    bfree(old);
+}
+
+char *gphoto_connection_get_string(struct gphoto_connection *connection, char *const *field) {
+    char *copy;
+
+    pthread_mutex_lock(&connection->mutex);
+    copy = bstrdup(*field ? *field : "");
+    pthread_mutex_unlock(&connection->mutex);
+    return copy;
+}
+
+bool gphoto_connection_string_is(struct gphoto_connection *connection, char *const *field, const char *value) {
+    bool ret;
+
+    pthread_mutex_lock(&connection->mutex);
+    ret = *field && value && strcmp(*field, value) == 0;
+    pthread_mutex_unlock(&connection->mutex);
+    return ret;
+}
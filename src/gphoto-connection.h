@@ -0,0 +1,72 @@
+#pragma once
+
+#include <obs-module.h>
+#include <pthread.h>
+
+enum gphoto_connection_state {
+    GPHOTO_CONNECTION_IDLE,
+    GPHOTO_CONNECTION_CONNECTING,
+    GPHOTO_CONNECTION_STREAMING,
+    GPHOTO_CONNECTION_RETRYING,
+    GPHOTO_CONNECTION_FAILED,
+    GPHOTO_CONNECTION_CLOSING,
+};
+
+/* Runs on the worker. connect returns false on failure, disconnect must cope with a half done connect. */
+typedef bool (*gphoto_connect_t)(void *param);
+typedef void (*gphoto_disconnect_t)(void *param);
+/* Runs on the worker with the camera open, applies changed settings. false reconnects. */
+typedef bool (*gphoto_refresh_t)(void *param);
+
+/*
+ * Opens and closes a source's camera on a worker thread, so show, hide and camera changes return
+ * at once. Requests only set what is wanted, the worker catches up: a failed connect is retried
+ * with a growing delay and given up after GPHOTO_CONNECT_ATTEMPTS until the next open.
+ */
+struct gphoto_connection {
+    obs_source_t *source;
+    gphoto_connect_t connect;
+    gphoto_disconnect_t disconnect;
+    gphoto_refresh_t refresh;
+    void *param;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    enum gphoto_connection_state state;
+    bool wanted;
+    bool connected;
+    bool stop;
+    bool refresh_wanted;
+    uint64_t generation;
+    uint64_t connected_generation;
+    uint32_t attempts;
+    uint64_t retry_at;
+};
+
+/* refresh may be NULL, gphoto_connection_refresh then restarts. */
+void gphoto_connection_init(struct gphoto_connection *connection, obs_source_t *source, gphoto_connect_t connect,
+                            gphoto_disconnect_t disconnect, gphoto_refresh_t refresh, void *param);
+void gphoto_connection_free(struct gphoto_connection *connection);
+
+void gphoto_connection_open(struct gphoto_connection *connection);
+void gphoto_connection_close(struct gphoto_connection *connection);
+void gphoto_connection_restart(struct gphoto_connection *connection);
+void gphoto_connection_refresh(struct gphoto_connection *connection);
+void gphoto_connection_retry(struct gphoto_connection *connection);
+
+enum gphoto_connection_state gphoto_connection_state(struct gphoto_connection *connection);
+const char *gphoto_connection_state_name(enum gphoto_connection_state state);
+
+bool gphoto_connection_lock_streaming(struct gphoto_connection *connection);
+/* For settings the worker reads: write them under the lock, the worker takes a snapshot under it. */
+void gphoto_connection_lock(struct gphoto_connection *connection);
+void gphoto_connection_unlock(struct gphoto_connection *connection);
+
+/*
+ * field belongs to the source, only the thread calling set may read it without a snapshot. get
+ * returns a copy to bfree.
+ */
+void gphoto_connection_set_string(struct gphoto_connection *connection, char **field, const char *value);
+char *gphoto_connection_get_string(struct gphoto_connection *connection, char *const *field);
+bool gphoto_connection_string_is(struct gphoto_connection *connection, char *const *field, const char *value);
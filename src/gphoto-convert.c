@@ -0,0 +1,403 @@
+#include <string.h>
+#include <obs-module.h>
+
+#include "gphoto-convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GPHOTO_CONVERT_X86 1
+#endif
+
+/*
+ * Q15 coefficients of the JFIF YCbCr to RGB matrix, with the integer part split off so every
+ * product fits the rounding 16 bit multiply (pmulhrsw) the SIMD kernels use.
+ */
+#define CR_R 13173   /* 1.402 - 1 */
+#define CB_G 11277   /* 0.344136 */
+#define CR_G 23401   /* 0.714136 */
+#define CB_B 25297   /* 1.772 - 1 */
+
+static inline int mulhrs(int a, int k) {
+    return (a * k + 0x4000) >> 15;
+}
+
+static inline uint8_t clamp_u8(int v) {
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+static void ycbcr_to_bgrx_scalar(const uint8_t *src, uint8_t *dst, size_t pixels) {
+    size_t i;
+    int y, cb, cr;
+
+    for (i = 0; i < pixels; i++) {
+        y = src[0];
+        cb = src[1] - 128;
+        cr = src[2] - 128;
+        dst[0] = clamp_u8(y + cb + mulhrs(cb, CB_B));
+        dst[1] = clamp_u8(y - mulhrs(cb, CB_G) - mulhrs(cr, CR_G));
+        dst[2] = clamp_u8(y + cr + mulhrs(cr, CR_R));
+        dst[3] = 0xFF;
+        src += 3;
+        dst += 4;
+    }
+}
+
+static void rgb_to_bgra_scalar(const uint8_t *src, uint8_t *dst, size_t pixels) {
+    size_t i;
+
+    for (i = 0; i < pixels; i++) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = 0xFF;
+        src += 3;
+        dst += 4;
+    }
+}
+
+static void fill_alpha_scalar(uint8_t *dst, size_t pixels) {
+    size_t i;
+
+    for (i = 0; i < pixels; i++) {
+        dst[i * 4 + 3] = 0xFF;
+    }
+}
+
+static void ycbcr_to_i420_scalar(const uint8_t *row0, const uint8_t *row1, uint8_t *luma0, uint8_t *luma1,
+                                 uint8_t *cb, uint8_t *cr, size_t pixels) {
+    const uint8_t *a, *b;
+    size_t x;
+
+    for (x = 0; x < pixels; x++) {
+        luma0[x] = row0[x * 3];
+        luma1[x] = row1[x * 3];
+    }
+    for (x = 0; x < pixels; x += 2) {
+        a = row0 + x * 3;
+        b = row1 + x * 3;
+        if (x + 1 < pixels) {
+            cb[x / 2] = (uint8_t)((a[1] + a[4] + b[1] + b[4] + 2) >> 2);
+            cr[x / 2] = (uint8_t)((a[2] + a[5] + b[2] + b[5] + 2) >> 2);
+        } else {
+            cb[x / 2] = (uint8_t)((a[1] + b[1] + 1) >> 1);
+            cr[x / 2] = (uint8_t)((a[2] + b[2] + 1) >> 1);
+        }
+    }
+}
+
+static void average_rows_scalar(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        dst[i] = (uint8_t)((a[i] + b[i] + 1) >> 1);
+    }
+}
+
+static const struct gphoto_convert_kernels kernels_scalar = {
+    "scalar",
+    ycbcr_to_bgrx_scalar,
+    rgb_to_bgra_scalar,
+    fill_alpha_scalar,
+    ycbcr_to_i420_scalar,
+    average_rows_scalar,
+};
+
+#ifdef GPHOTO_CONVERT_X86
+
+/* Byte shuffles pulling the Y, Cb and Cr of 8 pixels (24 bytes, split 16 + 8) into 16 bit lanes. */
+#define Z -1
+#define YCBCR_MASKS \
+    const __m128i y_lo = _mm_setr_epi8(0, Z, 3, Z, 6, Z, 9, Z, 12, Z, 15, Z, Z, Z, Z, Z); \
+    const __m128i y_hi = _mm_setr_epi8(Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 2, Z, 5, Z); \
+    const __m128i cb_lo = _mm_setr_epi8(1, Z, 4, Z, 7, Z, 10, Z, 13, Z, Z, Z, Z, Z, Z, Z); \
+    const __m128i cb_hi = _mm_setr_epi8(Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 0, Z, 3, Z, 6, Z); \
+    const __m128i cr_lo = _mm_setr_epi8(2, Z, 5, Z, 8, Z, 11, Z, 14, Z, Z, Z, Z, Z, Z, Z); \
+    const __m128i cr_hi = _mm_setr_epi8(Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 1, Z, 4, Z, 7, Z)
+/* Four RGB pixels (12 bytes) to BGR0, alpha is or-ed in afterwards. */
+#define RGB_MASK _mm_setr_epi8(2, 1, 0, Z, 5, 4, 3, Z, 8, 7, 6, Z, 11, 10, 9, Z)
+
+__attribute__((target("ssse3")))
+static void ycbcr_to_bgrx_ssse3(const uint8_t *src, uint8_t *dst, size_t pixels) {
+    YCBCR_MASKS;
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+    __m128i lo, hi, y, cb, cr, b, g, r, bg, ra;
+    size_t i = 0;
+
+    for (; i + 8 <= pixels; i += 8) {
+        lo = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        hi = _mm_loadl_epi64((const __m128i *)(src + i * 3 + 16));
+        y = _mm_or_si128(_mm_shuffle_epi8(lo, y_lo), _mm_shuffle_epi8(hi, y_hi));
+        cb = _mm_sub_epi16(_mm_or_si128(_mm_shuffle_epi8(lo, cb_lo), _mm_shuffle_epi8(hi, cb_hi)), bias);
+        cr = _mm_sub_epi16(_mm_or_si128(_mm_shuffle_epi8(lo, cr_lo), _mm_shuffle_epi8(hi, cr_hi)), bias);
+
+        b = _mm_add_epi16(_mm_add_epi16(y, cb), _mm_mulhrs_epi16(cb, _mm_set1_epi16(CB_B)));
+        g = _mm_sub_epi16(_mm_sub_epi16(y, _mm_mulhrs_epi16(cb, _mm_set1_epi16(CB_G))),
+                          _mm_mulhrs_epi16(cr, _mm_set1_epi16(CR_G)));
+        r = _mm_add_epi16(_mm_add_epi16(y, cr), _mm_mulhrs_epi16(cr, _mm_set1_epi16(CR_R)));
+
+        bg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g));
+        ra = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), alpha);
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i *)(dst + i * 4 + 16), _mm_unpackhi_epi16(bg, ra));
+    }
+    ycbcr_to_bgrx_scalar(src + i * 3, dst + i * 4, pixels - i);
+}
+
+__attribute__((target("ssse3")))
+static void rgb_to_bgra_ssse3(const uint8_t *src, uint8_t *dst, size_t pixels) {
+    const __m128i mask = RGB_MASK;
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    __m128i v;
+    size_t i = 0;
+
+    /* Each load reads 16 bytes for 12, stay 2 pixels away from the end of the row. */
+    for (; i + 6 <= pixels; i += 4) {
+        v = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(v, mask), alpha));
+    }
+    rgb_to_bgra_scalar(src + i * 3, dst + i * 4, pixels - i);
+}
+
+__attribute__((target("sse2")))
+static void fill_alpha_sse2(uint8_t *dst, size_t pixels) {
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    __m128i v;
+    size_t i = 0;
+
+    for (; i + 4 <= pixels; i += 4) {
+        v = _mm_loadu_si128((const __m128i *)(dst + i * 4));
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_or_si128(v, alpha));
+    }
+    fill_alpha_scalar(dst + i * 4, pixels - i);
+}
+
+/* The 2x2 chroma sums fit 16 bit lanes, horizontal adds pair the columns. */
+__attribute__((target("ssse3")))
+static void ycbcr_to_i420_ssse3(const uint8_t *row0, const uint8_t *row1, uint8_t *luma0, uint8_t *luma1,
+                                uint8_t *cb, uint8_t *cr, size_t pixels) {
+    YCBCR_MASKS;
+    const __m128i round = _mm_set1_epi16(2);
+    __m128i lo0, hi0, lo1, hi1, chroma_b, chroma_r, sums;
+    int packed;
+    size_t i = 0;
+
+    for (; i + 8 <= pixels; i += 8) {
+        lo0 = _mm_loadu_si128((const __m128i *)(row0 + i * 3));
+        hi0 = _mm_loadl_epi64((const __m128i *)(row0 + i * 3 + 16));
+        lo1 = _mm_loadu_si128((const __m128i *)(row1 + i * 3));
+        hi1 = _mm_loadl_epi64((const __m128i *)(row1 + i * 3 + 16));
+
+        sums = _mm_or_si128(_mm_shuffle_epi8(lo0, y_lo), _mm_shuffle_epi8(hi0, y_hi));
+        _mm_storel_epi64((__m128i *)(luma0 + i), _mm_packus_epi16(sums, sums));
+        sums = _mm_or_si128(_mm_shuffle_epi8(lo1, y_lo), _mm_shuffle_epi8(hi1, y_hi));
+        _mm_storel_epi64((__m128i *)(luma1 + i), _mm_packus_epi16(sums, sums));
+
+        chroma_b = _mm_add_epi16(_mm_or_si128(_mm_shuffle_epi8(lo0, cb_lo), _mm_shuffle_epi8(hi0, cb_hi)),
+                                 _mm_or_si128(_mm_shuffle_epi8(lo1, cb_lo), _mm_shuffle_epi8(hi1, cb_hi)));
+        chroma_r = _mm_add_epi16(_mm_or_si128(_mm_shuffle_epi8(lo0, cr_lo), _mm_shuffle_epi8(hi0, cr_hi)),
+                                 _mm_or_si128(_mm_shuffle_epi8(lo1, cr_lo), _mm_shuffle_epi8(hi1, cr_hi)));
+        sums = _mm_srli_epi16(_mm_add_epi16(_mm_hadd_epi16(chroma_b, chroma_r), round), 2);
+        sums = _mm_packus_epi16(sums, sums);
+
+        packed = _mm_cvtsi128_si32(sums);
+        memcpy(cb + i / 2, &packed, 4);
+        packed = _mm_cvtsi128_si32(_mm_srli_si128(sums, 4));
+        memcpy(cr + i / 2, &packed, 4);
+    }
+    ycbcr_to_i420_scalar(row0 + i * 3, row1 + i * 3, luma0 + i, luma1 + i, cb + i / 2, cr + i / 2, pixels - i);
+}
+
+__attribute__((target("sse2")))
+static void average_rows_sse2(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count) {
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                                            _mm_loadu_si128((const __m128i *)(b + i))));
+    }
+    average_rows_scalar(dst + i, a + i, b + i, count - i);
+}
+
+/* AVX2 shuffles stay inside 128 bit lanes, so every lane converts its own group of pixels. */
+__attribute__((target("avx2")))
+static void ycbcr_to_bgrx_avx2(const uint8_t *src, uint8_t *dst, size_t pixels) {
+    YCBCR_MASKS;
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i alpha = _mm256_set1_epi8((char)0xFF);
+    const __m256i y_lo2 = _mm256_broadcastsi128_si256(y_lo), y_hi2 = _mm256_broadcastsi128_si256(y_hi);
+    const __m256i cb_lo2 = _mm256_broadcastsi128_si256(cb_lo), cb_hi2 = _mm256_broadcastsi128_si256(cb_hi);
+    const __m256i cr_lo2 = _mm256_broadcastsi128_si256(cr_lo), cr_hi2 = _mm256_broadcastsi128_si256(cr_hi);
+    __m256i lo, hi, y, cb, cr, b, g, r, bg, ra, px0, px1;
+    const uint8_t *s;
+    size_t i = 0;
+
+    for (; i + 16 <= pixels; i += 16) {
+        s = src + i * 3;
+        lo = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)s)),
+                                     _mm_loadu_si128((const __m128i *)(s + 24)), 1);
+        hi = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)(s + 16))),
+                                     _mm_loadl_epi64((const __m128i *)(s + 40)), 1);
+        y = _mm256_or_si256(_mm256_shuffle_epi8(lo, y_lo2), _mm256_shuffle_epi8(hi, y_hi2));
+        cb = _mm256_sub_epi16(_mm256_or_si256(_mm256_shuffle_epi8(lo, cb_lo2), _mm256_shuffle_epi8(hi, cb_hi2)),
+                              bias);
+        cr = _mm256_sub_epi16(_mm256_or_si256(_mm256_shuffle_epi8(lo, cr_lo2), _mm256_shuffle_epi8(hi, cr_hi2)),
+                              bias);
+
+        b = _mm256_add_epi16(_mm256_add_epi16(y, cb), _mm256_mulhrs_epi16(cb, _mm256_set1_epi16(CB_B)));
+        g = _mm256_sub_epi16(_mm256_sub_epi16(y, _mm256_mulhrs_epi16(cb, _mm256_set1_epi16(CB_G))),
+                             _mm256_mulhrs_epi16(cr, _mm256_set1_epi16(CR_G)));
+        r = _mm256_add_epi16(_mm256_add_epi16(y, cr), _mm256_mulhrs_epi16(cr, _mm256_set1_epi16(CR_R)));
+
+        bg = _mm256_unpacklo_epi8(_mm256_packus_epi16(b, b), _mm256_packus_epi16(g, g));
+        ra = _mm256_unpacklo_epi8(_mm256_packus_epi16(r, r), alpha);
+        px0 = _mm256_unpacklo_epi16(bg, ra);
+        px1 = _mm256_unpackhi_epi16(bg, ra);
+        _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_permute2x128_si256(px0, px1, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + i * 4 + 32), _mm256_permute2x128_si256(px0, px1, 0x31));
+    }
+    ycbcr_to_bgrx_ssse3(src + i * 3, dst + i * 4, pixels - i);
+}
+
+__attribute__((target("avx2")))
+static void rgb_to_bgra_avx2(const uint8_t *src, uint8_t *dst, size_t pixels) {
+    const __m256i mask = _mm256_broadcastsi128_si256(RGB_MASK);
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    __m256i v;
+    const uint8_t *s;
+    size_t i = 0;
+
+    /* The second lane reads 16 bytes from pixel 4, stay 2 pixels away from the end of the row. */
+    for (; i + 10 <= pixels; i += 8) {
+        s = src + i * 3;
+        v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)s)),
+                                    _mm_loadu_si128((const __m128i *)(s + 12)), 1);
+        _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha));
+    }
+    rgb_to_bgra_ssse3(src + i * 3, dst + i * 4, pixels - i);
+}
+
+__attribute__((target("avx2")))
+static void fill_alpha_avx2(uint8_t *dst, size_t pixels) {
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    __m256i v;
+    size_t i = 0;
+
+    for (; i + 8 <= pixels; i += 8) {
+        v = _mm256_loadu_si256((const __m256i *)(dst + i * 4));
+        _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_or_si256(v, alpha));
+    }
+    fill_alpha_sse2(dst + i * 4, pixels - i);
+}
+
+__attribute__((target("avx2")))
+static void ycbcr_to_i420_avx2(const uint8_t *row0, const uint8_t *row1, uint8_t *luma0, uint8_t *luma1,
+                               uint8_t *cb, uint8_t *cr, size_t pixels) {
+    YCBCR_MASKS;
+    const __m256i y_lo2 = _mm256_broadcastsi128_si256(y_lo), y_hi2 = _mm256_broadcastsi128_si256(y_hi);
+    const __m256i cb_lo2 = _mm256_broadcastsi128_si256(cb_lo), cb_hi2 = _mm256_broadcastsi128_si256(cb_hi);
+    const __m256i cr_lo2 = _mm256_broadcastsi128_si256(cr_lo), cr_hi2 = _mm256_broadcastsi128_si256(cr_hi);
+    /* After the lane merge the chroma bytes are Cb 0-3, Cr 0-3, Cb 4-7, Cr 4-7. */
+    const __m128i planes = _mm_setr_epi8(0, 1, 2, 3, 8, 9, 10, 11, 4, 5, 6, 7, 12, 13, 14, 15);
+    const __m256i round = _mm256_set1_epi16(2);
+    __m256i lo0, hi0, lo1, hi1, chroma_b, chroma_r, sums;
+    __m128i merged;
+    const uint8_t *s0, *s1;
+    size_t i = 0;
+
+    for (; i + 16 <= pixels; i += 16) {
+        s0 = row0 + i * 3;
+        s1 = row1 + i * 3;
+        lo0 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)s0)),
+                                      _mm_loadu_si128((const __m128i *)(s0 + 24)), 1);
+        hi0 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)(s0 + 16))),
+                                      _mm_loadl_epi64((const __m128i *)(s0 + 40)), 1);
+        lo1 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)s1)),
+                                      _mm_loadu_si128((const __m128i *)(s1 + 24)), 1);
+        hi1 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)(s1 + 16))),
+                                      _mm_loadl_epi64((const __m128i *)(s1 + 40)), 1);
+
+        sums = _mm256_or_si256(_mm256_shuffle_epi8(lo0, y_lo2), _mm256_shuffle_epi8(hi0, y_hi2));
+        sums = _mm256_permute4x64_epi64(_mm256_packus_epi16(sums, sums), 0x08);
+        _mm_storeu_si128((__m128i *)(luma0 + i), _mm256_castsi256_si128(sums));
+        sums = _mm256_or_si256(_mm256_shuffle_epi8(lo1, y_lo2), _mm256_shuffle_epi8(hi1, y_hi2));
+        sums = _mm256_permute4x64_epi64(_mm256_packus_epi16(sums, sums), 0x08);
+        _mm_storeu_si128((__m128i *)(luma1 + i), _mm256_castsi256_si128(sums));
+
+        chroma_b = _mm256_add_epi16(
+            _mm256_or_si256(_mm256_shuffle_epi8(lo0, cb_lo2), _mm256_shuffle_epi8(hi0, cb_hi2)),
+            _mm256_or_si256(_mm256_shuffle_epi8(lo1, cb_lo2), _mm256_shuffle_epi8(hi1, cb_hi2)));
+        chroma_r = _mm256_add_epi16(
+            _mm256_or_si256(_mm256_shuffle_epi8(lo0, cr_lo2), _mm256_shuffle_epi8(hi0, cr_hi2)),
+            _mm256_or_si256(_mm256_shuffle_epi8(lo1, cr_lo2), _mm256_shuffle_epi8(hi1, cr_hi2)));
+        sums = _mm256_srli_epi16(_mm256_add_epi16(_mm256_hadd_epi16(chroma_b, chroma_r), round), 2);
+        sums = _mm256_permute4x64_epi64(_mm256_packus_epi16(sums, sums), 0x08);
+        merged = _mm_shuffle_epi8(_mm256_castsi256_si128(sums), planes);
+
+        _mm_storel_epi64((__m128i *)(cb + i / 2), merged);
+        _mm_storel_epi64((__m128i *)(cr + i / 2), _mm_srli_si128(merged, 8));
+    }
+    ycbcr_to_i420_ssse3(row0 + i * 3, row1 + i * 3, luma0 + i, luma1 + i, cb + i / 2, cr + i / 2, pixels - i);
+}
+
+__attribute__((target("avx2")))
+static void average_rows_avx2(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count) {
+    size_t i = 0;
+
+    for (; i + 32 <= count; i += 32) {
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                                                  _mm256_loadu_si256((const __m256i *)(b + i))));
+    }
+    average_rows_sse2(dst + i, a + i, b + i, count - i);
+}
+
+#undef Z
+
+/* SSE2 without SSSE3 has no byte shuffle, only the averaging and the alpha fill gain from it. */
+static const struct gphoto_convert_kernels kernels_sse2 = {
+    "sse2",
+    ycbcr_to_bgrx_scalar,
+    rgb_to_bgra_scalar,
+    fill_alpha_sse2,
+    ycbcr_to_i420_scalar,
+    average_rows_sse2,
+};
+
+static const struct gphoto_convert_kernels kernels_ssse3 = {
+    "ssse3",
+    ycbcr_to_bgrx_ssse3,
+    rgb_to_bgra_ssse3,
+    fill_alpha_sse2,
+    ycbcr_to_i420_ssse3,
+    average_rows_sse2,
+};
+
+static const struct gphoto_convert_kernels kernels_avx2 = {
+    "avx2",
+    ycbcr_to_bgrx_avx2,
+    rgb_to_bgra_avx2,
+    fill_alpha_avx2,
+    ycbcr_to_i420_avx2,
+    average_rows_avx2,
+};
+#endif
+
+const struct gphoto_convert_kernels *gphoto_convert = &kernels_scalar;
+
+void gphoto_convert_init(void) {
+#ifdef GPHOTO_CONVERT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        gphoto_convert = &kernels_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        gphoto_convert = &kernels_ssse3;
+    } else if (__builtin_cpu_supports("sse2")) {
+        gphoto_convert = &kernels_sse2;
+    }
+#endif
+    blog(LOG_INFO, "Colour conversion kernels: %s.\n", gphoto_convert->name);
+}
+
+const struct gphoto_convert_kernels *gphoto_convert_reference(void) {
+    return &kernels_scalar;
+}
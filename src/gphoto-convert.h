@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Colour conversion kernels for packed pixel rows and for the separate passes of the I420 live view
+ * decode. YCbCr is full range BT.601 as used by JFIF. Every variant produces bit exact results to the
+ * scalar reference.
+ */
+struct gphoto_convert_kernels {
+    const char *name;
+    void (*ycbcr_to_bgrx)(const uint8_t *src, uint8_t *dst, size_t pixels);
+    void (*rgb_to_bgra)(const uint8_t *src, uint8_t *dst, size_t pixels);
+    /* Sets the fourth byte of every BGRX pixel to 0xFF. */
+    void (*fill_alpha)(uint8_t *dst, size_t pixels);
+    /* Two rows of interleaved YCbCr to two luma rows and one row of each chroma plane, 2x2 averaged. */
+    void (*ycbcr_to_i420)(const uint8_t *row0, const uint8_t *row1, uint8_t *luma0, uint8_t *luma1, uint8_t *cb,
+                          uint8_t *cr, size_t pixels);
+    /* dst is the rounded up mean of a and b, byte by byte. */
+    void (*average_rows)(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count);
+};
+
+/* Best kernels for this CPU, the scalar reference until gphoto_convert_init() ran. */
+extern const struct gphoto_convert_kernels *gphoto_convert;
+
+void gphoto_convert_init(void);
+const struct gphoto_convert_kernels *gphoto_convert_reference(void);
@@ -0,0 +1,854 @@
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "gphoto-device.h"
+#include "gphoto-discovery.h"
+#include "gphoto-jpeg.h"
+#include "gphoto-sizes.h"
+#include "gphoto-trace.h"
+#include "gphoto-utils.h"
+
+static pthread_mutex_t devices_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct gphoto_device *devices = NULL;
+
+/* Sources reconnect after the removal, they must get a new device and not the one of the old camera. */
+static void devices_camera_removed(void *vptr, calldata_t *calldata) {
+    UNUSED_PARAMETER(vptr);
+    const char *model = calldata_string(calldata, "model");
+    struct gphoto_device *device;
+
+    pthread_mutex_lock(&devices_mutex);
+    for (device = devices; device; device = device->next) {
+        if (model && strcmp(device->model, model) == 0) {
+            device->gone = true;
+        }
+    }
+    pthread_mutex_unlock(&devices_mutex);
+}
+
+void gphoto_devices_init(void) {
+    signal_handler_connect(gphoto_discovery_signalhandler(), "camera_removed", devices_camera_removed, NULL);
+}
+
+void gphoto_devices_free(void) {
+    signal_handler_disconnect(gphoto_discovery_signalhandler(), "camera_removed", devices_camera_removed, NULL);
+}
+
+/*
+ * Runs on the executor, the dialogs only wait for the swap. The flag is cleared before the fetch,
+ * a change reported meanwhile marks the new tree stale again.
+ */
+static void device_load_config(struct gphoto_device *device) {
+    CameraWidget *config = NULL, *old = NULL;
+    uint64_t span = gphoto_trace_now();
+
+    pthread_mutex_lock(&device->config_mutex);
+    device->config_stale = false;
+    pthread_mutex_unlock(&device->config_mutex);
+    if (gphoto_camera_get_config(device->camera, &config, device->context) < GP_OK) {
+        blog(LOG_WARNING, "%s: can't get the camera config.\n", device->model);
+        gphoto_device_config_changed(device);
+    } else {
+        pthread_mutex_lock(&device->config_mutex);
+        old = device->config;
+        device->config = config;
+        pthread_mutex_unlock(&device->config_mutex);
+    }
+    if (old) {
+        gp_widget_free(old);
+    }
+    gphoto_trace_end("get config", span);
+}
+
+static void device_reload_command(void *vptr) {
+    struct gphoto_device *device = vptr;
+
+    pthread_mutex_lock(&device->config_mutex);
+    device->config_reload_queued = false;
+    pthread_mutex_unlock(&device->config_mutex);
+    if (device->camera) {
+        device_load_config(device);
+    }
+}
+
+/* The first source opens the camera, the others find it open once their call runs. */
+static void device_open_command(void *vptr) {
+    struct gphoto_device *device = vptr;
+    struct gphoto_camera *camera = NULL;
+    CameraList *cameras = NULL;
+    uint64_t span;
+
+    if (device->camera) {
+        return;
+    }
+    span = gphoto_trace_now();
+    gp_list_new(&cameras);
+    gphoto_discovery_list(cameras);
+    if (gphoto_camera_by_name(&camera, device->model, cameras, device->context) < GP_OK) {
+        blog(LOG_WARNING, "Can't get camera.\n");
+        gphoto_camera_free(camera);
+    } else if (gphoto_camera_init(camera, device->context) < GP_OK) {
+        blog(LOG_WARNING, "Can't init camera.\n");
+        gphoto_camera_free(camera);
+    } else {
+        device->camera = camera;
+        device_load_config(device);
+    }
+    gp_list_free(cameras);
+    gphoto_trace_end("camera init", span);
+}
+
+static struct gphoto_device *device_create(const char *model) {
+    struct gphoto_device *device = bzalloc(sizeof(struct gphoto_device));
+
+    device->model = bstrdup(model);
+    device->refs = 1;
+    device->context = gp_context_new();
+    pthread_mutex_init(&device->config_mutex, NULL);
+    pthread_mutex_init(&device->live_mutex, NULL);
+    pthread_mutex_init(&device->viewers_mutex, NULL);
+    pthread_mutex_init(&device->writes_mutex, NULL);
+    gphoto_executor_init(&device->executor);
+    return device;
+}
+
+/* Commands still queued run before the executor stops, nothing else uses the camera after that. */
+static void device_destroy(struct gphoto_device *device) {
+    gphoto_executor_free(&device->executor);
+    if (device->config) {
+        gp_widget_free(device->config);
+    }
+    if (device->camera) {
+        gphoto_camera_exit(device->camera, device->context);
+        gphoto_camera_free(device->camera);
+        blog(LOG_INFO, "%s: camera closed.\n", device->model);
+    }
+    obs_data_release(device->writes);
+    pthread_mutex_destroy(&device->writes_mutex);
+    pthread_mutex_destroy(&device->viewers_mutex);
+    pthread_mutex_destroy(&device->live_mutex);
+    pthread_mutex_destroy(&device->config_mutex);
+    gp_context_unref(device->context);
+    bfree(device->model);
+    bfree(device);
+}
+
+struct gphoto_device *gphoto_device_open(const char *model) {
+    struct gphoto_device *device;
+
+    pthread_mutex_lock(&devices_mutex);
+    for (device = devices; device; device = device->next) {
+        if (!device->gone && strcmp(device->model, model) == 0) {
+            break;
+        }
+    }
+    if (device) {
+        device->refs++;
+    } else {
+        device = device_create(model);
+        device->next = devices;
+        devices = device;
+    }
+    pthread_mutex_unlock(&devices_mutex);
+
+    gphoto_executor_call(&device->executor, GPHOTO_PRIORITY_USER, device_open_command, device);
+    if (!device->camera) {
+        gphoto_device_close(device);
+        return NULL;
+    }
+    return device;
+}
+
+/* The last reference closes the camera. Every viewer must have stopped watching before. */
+void gphoto_device_close(struct gphoto_device *device) {
+    struct gphoto_device **link;
+    bool last;
+
+    pthread_mutex_lock(&devices_mutex);
+    last = --device->refs == 0;
+    if (last) {
+        for (link = &devices; *link != device; link = &(*link)->next);
+        *link = device->next;
+    }
+    pthread_mutex_unlock(&devices_mutex);
+
+    if (last) {
+        device_destroy(device);
+    }
+}
+
+void gphoto_device_submit(struct gphoto_device *device, enum gphoto_priority priority, gphoto_command_t run,
+                          void *param) {
+    gphoto_executor_submit(&device->executor, priority, run, param);
+}
+
+void gphoto_device_call(struct gphoto_device *device, enum gphoto_priority priority, gphoto_command_t run,
+                        void *param) {
+    gphoto_executor_call(&device->executor, priority, run, param);
+}
+
+void gphoto_device_flush(struct gphoto_device *device) {
+    gphoto_executor_flush(&device->executor);
+}
+
+/*
+ * Property dialogs are built from memory and never wait for the camera. A missing or stale tree is
+ * fetched again in the background, the next dialog gets it. Camera events don't say which config
+ * changed, so the whole tree is reloaded. What the plugin writes goes through the tree.
+ */
+CameraWidget *gphoto_device_config_lock(struct gphoto_device *device) {
+    pthread_mutex_lock(&device->config_mutex);
+    if ((!device->config || device->config_stale) && !device->config_reload_queued) {
+        device->config_reload_queued = true;
+        gphoto_executor_submit(&device->executor, GPHOTO_PRIORITY_USER, device_reload_command, device);
+    }
+    return device->config;
+}
+
+void gphoto_device_config_unlock(struct gphoto_device *device) {
+    pthread_mutex_unlock(&device->config_mutex);
+}
+
+void gphoto_device_config_changed(struct gphoto_device *device) {
+    pthread_mutex_lock(&device->config_mutex);
+    device->config_stale = true;
+    pthread_mutex_unlock(&device->config_mutex);
+}
+
+/* Runs on the executor. Writes each changed widget on its own, flags are cleared by gp_widget_changed. */
+static int device_write_single(struct gphoto_device *device, CameraWidget *config, obs_data_t *writes) {
+    obs_data_item_t *item;
+    CameraWidget *widget;
+    const char *name;
+    int ret = GP_OK;
+
+    for (item = obs_data_first(writes); item; obs_data_item_next(&item)) {
+        name = obs_data_item_get_name(item);
+        widget = gphoto_config_find(config, name);
+        if (widget && gp_widget_changed(widget) &&
+            gphoto_camera_set_single_config(device->camera, name, widget, device->context) < GP_OK) {
+            blog(LOG_WARNING, "Can't set config %s for camera.\n", name);
+            ret = GP_ERROR;
+        }
+    }
+    return ret;
+}
+
+/*
+ * Runs on the executor. Everything queued is set in the config tree first, values the camera
+ * already has are dropped. One changed config is written on its own, more go out together in one
+ * set_config, which only sends the changed widgets.
+ */
+static void device_write_command(void *vptr) {
+    struct gphoto_device *device = vptr;
+    obs_data_t *writes;
+    obs_data_item_t *item;
+    CameraWidget *config, *widget;
+    const char *name;
+    int changed = 0, ret = GP_OK;
+    bool reload;
+    uint64_t span;
+
+    pthread_mutex_lock(&device->writes_mutex);
+    writes = device->writes;
+    device->writes = NULL;
+    pthread_mutex_unlock(&device->writes_mutex);
+    if (!writes) {
+        return;
+    }
+
+    span = gphoto_trace_now();
+    /* Values are compared with the tree, one the camera may have changed since is fetched first. */
+    pthread_mutex_lock(&device->config_mutex);
+    reload = !device->config || device->config_stale;
+    pthread_mutex_unlock(&device->config_mutex);
+    if (reload) {
+        device_load_config(device);
+    }
+    /* Only this thread changes the tree, dialogs reading it meanwhile see old or new values. */
+    pthread_mutex_lock(&device->config_mutex);
+    config = device->config;
+    reload = device->config_stale;
+    for (item = obs_data_first(writes); item; obs_data_item_next(&item)) {
+        name = obs_data_item_get_name(item);
+        widget = gphoto_config_find(config, name);
+        if (!widget) {
+            blog(LOG_WARNING, "Can't get config %s for camera.\n", name);
+        } else if (gphoto_config_assign(widget, writes, name)) {
+            changed++;
+        } else if (reload) {
+            /* The tree couldn't be fetched again, an equal value there says nothing about the camera. */
+            gp_widget_set_changed(widget, 1);
+            changed++;
+        }
+    }
+    pthread_mutex_unlock(&device->config_mutex);
+
+    if (changed) {
+        /* Some bodies refuse settings while the focus drive runs, once per batch is enough. */
+        cancel_autofocus(device->camera, device->context);
+        if (changed > 1) {
+            ret = gphoto_camera_set_config(device->camera, config, device->context);
+        }
+        if (changed == 1 || ret == GP_ERROR_NOT_SUPPORTED) {
+            ret = device_write_single(device, config, writes);
+        }
+        if (ret < GP_OK) {
+            blog(LOG_WARNING, "%s: can't write the camera config.\n", device->model);
+            /* The tree holds values the camera didn't take. */
+            gphoto_device_config_changed(device);
+        }
+    }
+    obs_data_release(writes);
+    gphoto_trace_end("set config", span);
+}
+
+/*
+ * Queued again before it was written, a config only keeps the last value. One command writes
+ * everything queued until it runs, it goes ahead of the live view fetches.
+ */
+void gphoto_device_set_config(struct gphoto_device *device, obs_data_t *settings, const char *name) {
+    obs_data_item_t *item = obs_data_item_byname(settings, name);
+    bool submit = false;
+
+    pthread_mutex_lock(&device->writes_mutex);
+    if (!device->writes) {
+        device->writes = obs_data_create();
+        submit = true;
+    }
+    switch (obs_data_item_gettype(item)) {
+        case OBS_DATA_STRING:
+            obs_data_set_string(device->writes, name, obs_data_item_get_string(item));
+            break;
+        case OBS_DATA_NUMBER:
+            obs_data_set_double(device->writes, name, obs_data_item_get_double(item));
+            break;
+        case OBS_DATA_BOOLEAN:
+            obs_data_set_bool(device->writes, name, obs_data_item_get_bool(item));
+            break;
+        default:
+            break;
+    }
+    pthread_mutex_unlock(&device->writes_mutex);
+    obs_data_item_release(&item);
+
+    if (submit) {
+        gphoto_executor_submit(&device->executor, GPHOTO_PRIORITY_USER, device_write_command, device);
+    }
+}
+
+static void device_autofocus_command(void *vptr) {
+    struct gphoto_device *device = vptr;
+
+    set_autofocus(device->camera, device->context);
+}
+
+static void device_cancel_autofocus_command(void *vptr) {
+    struct gphoto_device *device = vptr;
+
+    cancel_autofocus(device->camera, device->context);
+}
+
+void gphoto_device_set_autofocus(struct gphoto_device *device, bool enabled) {
+    gphoto_executor_submit(&device->executor, GPHOTO_PRIORITY_USER,
+                           enabled ? device_autofocus_command : device_cancel_autofocus_command, device);
+}
+
+struct device_focus_step {
+    struct gphoto_device *device;
+    char *value;
+};
+
+static void device_manualfocus_command(void *vptr) {
+    struct device_focus_step *step = vptr;
+
+    set_manualfocus(step->value, step->device->camera, step->device->context);
+    bfree(step->value);
+    bfree(step);
+}
+
+void gphoto_device_set_manualfocus(struct gphoto_device *device, const char *value) {
+    struct device_focus_step *step = bzalloc(sizeof(struct device_focus_step));
+
+    step->device = device;
+    step->value = bstrdup(value);
+    gphoto_executor_submit(&device->executor, GPHOTO_PRIORITY_USER, device_manualfocus_command, step);
+}
+
+/* Runs on the decode threads of the group, frames leave in capture order. */
+static void group_output(void *vptr, struct obs_source_frame *frame) {
+    struct gphoto_decode_group *group = vptr;
+    struct gphoto_viewer *viewer;
+
+    pthread_mutex_lock(&group->mutex);
+    for (viewer = group->viewers; viewer; viewer = viewer->next) {
+        viewer->output(viewer->param, frame);
+    }
+    pthread_mutex_unlock(&group->mutex);
+}
+
+/* DCT scaling only exists for JPEG, ImageMagick decoded streams always run at full size. */
+static void group_start(struct gphoto_device *device, struct gphoto_decode_group *group) {
+    uint32_t scale = device->lv_jpeg ? group->scale : 1;
+
+    preview_session_init(&group->session, device->lv_width, device->lv_height, scale, group->format, group->depth);
+    preview_session_start(&group->session, group_output, group, &device->stats);
+}
+
+static void group_stop(struct gphoto_decode_group *group) {
+    preview_session_stop(&group->session);
+    preview_session_free(&group->session);
+}
+
+static struct gphoto_decode_group *group_create(struct gphoto_device *device, struct gphoto_viewer *viewer) {
+    struct gphoto_decode_group *group = bzalloc(sizeof(struct gphoto_decode_group));
+
+    group->format = viewer->format;
+    group->scale = viewer->scale;
+    group->depth = viewer->depth;
+    group->refs = 1;
+    pthread_mutex_init(&group->mutex, NULL);
+    group_start(device, group);
+    return group;
+}
+
+static void group_destroy(struct gphoto_decode_group *group) {
+    group_stop(group);
+    pthread_mutex_destroy(&group->mutex);
+    bfree(group);
+}
+
+/* Called with the viewers lock held. The same size group_start gives the session, which may be restarting. */
+static void group_set_viewer_size(struct gphoto_device *device, struct gphoto_decode_group *group,
+                                  struct gphoto_viewer *viewer) {
+    uint32_t scale = device->lv_jpeg ? group->scale : 1;
+
+    viewer->width = gphoto_jpeg_scaled(device->lv_width, scale);
+    viewer->height = gphoto_jpeg_scaled(device->lv_height, scale);
+}
+
+/* Called with the viewers lock held: the fastest viewer sets the fps, smooth pacing if any viewer asks for it. */
+static void device_retune(struct gphoto_device *device) {
+    struct gphoto_decode_group *group;
+    struct gphoto_viewer *viewer;
+    enum preview_pacing mode = PREVIEW_PACING_LATENCY;
+    long long fps = 0;
+
+    for (group = device->groups; group; group = group->next) {
+        for (viewer = group->viewers; viewer; viewer = viewer->next) {
+            if (viewer->fps > fps) {
+                fps = viewer->fps;
+            }
+            if (viewer->pacing == PREVIEW_PACING_SMOOTH) {
+                mode = PREVIEW_PACING_SMOOTH;
+            }
+        }
+    }
+    preview_pacer_set_fps(&device->pacer, fps);
+    device->pacer.mode = mode;
+}
+
+/*
+ * First frame of a live view started from a cached size, called with the viewers lock held. A stale
+ * size is replaced and the viewers get the real one, true if the fetch thread has to restart the decodes.
+ */
+static bool device_check_size(struct gphoto_device *device, const uint8_t *image_data, size_t data_size) {
+    struct gphoto_frame_size size = {0};
+    struct gphoto_decode_group *group;
+    struct gphoto_viewer *viewer;
+
+    device->lv_cached = false;
+    if (!gphoto_image_size(image_data, data_size, &size.width, &size.height)) {
+        return false;
+    }
+    size.jpeg = gphoto_jpeg_is_jpeg(image_data, data_size);
+    if (size.width == device->lv_width && size.height == device->lv_height && size.jpeg == device->lv_jpeg) {
+        return false;
+    }
+
+    blog(LOG_INFO, "%s: live view is %ux%u, not %ux%u as cached, restarting.\n", device->model,
+         size.width, size.height, device->lv_width, device->lv_height);
+    device->lv_width = size.width;
+    device->lv_height = size.height;
+    device->lv_jpeg = size.jpeg;
+
+    for (group = device->groups; group; group = group->next) {
+        for (viewer = group->viewers; viewer; viewer = viewer->next) {
+            group_set_viewer_size(device, group, viewer);
+        }
+    }
+    return true;
+}
+
+/* Fetch thread: drops the references of one frame, a group its last viewer left meanwhile ends here. */
+static void device_release_groups(struct gphoto_device *device, struct gphoto_decode_group *groups) {
+    struct gphoto_decode_group *group, *next, *released = NULL;
+
+    pthread_mutex_lock(&device->viewers_mutex);
+    for (group = groups; group; group = next) {
+        next = group->fetch_next;
+        if (!--group->refs) {
+            group->fetch_next = released;
+            released = group;
+        }
+    }
+    pthread_mutex_unlock(&device->viewers_mutex);
+
+    for (group = released; group; group = next) {
+        next = group->fetch_next;
+        group_destroy(group);
+    }
+}
+
+/* Config changes are noticed even without a timelapse source polling, at most this often. */
+#define DEVICE_EVENT_INTERVAL 100000000ULL
+#define DEVICE_EVENTS_PER_CHECK 4
+
+static int device_wait_for_event(struct gphoto_device *device, int timeout, CameraEventType *type, void **data) {
+    int ret;
+
+    *data = NULL;
+    ret = gphoto_camera_wait_for_event(device->camera, timeout, type, data, device->context);
+    if (ret >= GP_OK && *type == GP_EVENT_UNKNOWN && *data && strstr(*data, "changed")) {
+        /* libgphoto2 reports e.g. a turned dial as "PTP Property d102 changed". */
+        gphoto_device_config_changed(device);
+    }
+    return ret;
+}
+
+int gphoto_device_wait_for_event(struct gphoto_device *device, int timeout, CameraEventType *type, void **data) {
+    CameraFilePath *path;
+
+    if (!device->added_count) {
+        return device_wait_for_event(device, timeout, type, data);
+    }
+    path = malloc(sizeof(CameraFilePath));
+    *path = device->added[0];
+    device->added_count--;
+    memmove(device->added, device->added + 1, device->added_count * sizeof(CameraFilePath));
+    *type = GP_EVENT_FILE_ADDED;
+    *data = path;
+    return GP_OK;
+}
+
+static void device_watch_files_command(void *vptr) {
+    struct gphoto_device *device = vptr;
+
+    device->file_watchers++;
+}
+
+static void device_unwatch_files_command(void *vptr) {
+    struct gphoto_device *device = vptr;
+
+    if (!--device->file_watchers) {
+        device->added_count = 0;
+    }
+}
+
+void gphoto_device_watch_files(struct gphoto_device *device, bool watch) {
+    gphoto_executor_submit(&device->executor, GPHOTO_PRIORITY_USER,
+                           watch ? device_watch_files_command : device_unwatch_files_command, device);
+}
+
+/*
+ * Runs on the executor between live view frames, never waits. A new photo is kept while a source
+ * watches for them, the oldest goes.
+ */
+static void device_check_events(struct gphoto_device *device) {
+    CameraEventType type;
+    void *data;
+    uint64_t span;
+    int i;
+
+    if (os_gettime_ns() < device->events_at) {
+        return;
+    }
+    span = gphoto_trace_now();
+    for (i = 0; i < DEVICE_EVENTS_PER_CHECK; i++) {
+        if (device_wait_for_event(device, 0, &type, &data) < GP_OK || type == GP_EVENT_TIMEOUT) {
+            free(data);
+            break;
+        }
+        if (type == GP_EVENT_FILE_ADDED && data && device->file_watchers) {
+            if (device->added_count == GPHOTO_DEVICE_ADDED_FILES) {
+                device->added_count--;
+                memmove(device->added, device->added + 1, device->added_count * sizeof(CameraFilePath));
+            }
+            device->added[device->added_count++] = *(CameraFilePath *)data;
+        }
+        free(data);
+    }
+    device->events_at = os_gettime_ns() + DEVICE_EVENT_INTERVAL;
+    gphoto_trace_end("check events", span);
+}
+
+struct device_fetch_call {
+    struct gphoto_device *device;
+    uint64_t start;
+    uint64_t end;
+    int ret;
+};
+
+static void device_fetch_command(void *vptr) {
+    struct device_fetch_call *call = vptr;
+    struct gphoto_device *device = call->device;
+
+    call->start = os_gettime_ns();
+    call->ret = preview_fetch_capture(&device->fetch, device->camera, device->context);
+    call->end = os_gettime_ns();
+    device_check_events(device);
+}
+
+/*
+ * The viewers lock is only held to pace and to pick the groups of a frame. Copying it into the rings
+ * and restarting decodes, which joins their threads, run without it so watch and unwatch don't wait.
+ */
+static void *device_fetch_thread(void *vptr) {
+    struct gphoto_device *device = vptr;
+    struct gphoto_decode_group *group, *groups;
+    struct device_fetch_call call = {.device = device};
+    struct gphoto_frame_size size;
+    uint64_t next_poll, queued, fetch_start, fetch_end, timestamp;
+    const uint8_t *image_data;
+    size_t data_size;
+    bool fresh, resized, stop;
+    int ret;
+
+    gphoto_trace_thread_name("preview fetch");
+    while (true) {
+        pthread_mutex_lock(&device->viewers_mutex);
+        stop = device->fetch_stop;
+        next_poll = preview_pacer_next_poll(&device->pacer);
+        pthread_mutex_unlock(&device->viewers_mutex);
+        if (stop) {
+            break;
+        }
+        os_sleepto_ns(next_poll);
+
+        /* Only the USB transfer runs on the executor, behind anything more urgent. The decode threads run meanwhile. */
+        queued = os_gettime_ns();
+        gphoto_executor_call(&device->executor, GPHOTO_PRIORITY_POLL, device_fetch_command, &call);
+        fetch_start = call.start;
+        fetch_end = call.end;
+        ret = call.ret;
+        gphoto_stats_record(&device->stats, GPHOTO_STAGE_QUEUE_WAIT, fetch_start - queued);
+        gphoto_stats_record(&device->stats, GPHOTO_STAGE_FETCH, fetch_end - fetch_start);
+        gphoto_trace_span("fetch", fetch_start, fetch_end);
+
+        if (ret < GP_OK) {
+            blog(LOG_DEBUG, "Can't capture preview.\n");
+            fresh = false;
+        } else {
+            /* Repeats of the last frame are dropped here, before they cost a decode. */
+            fresh = preview_fetch_check_fresh(&device->fetch);
+        }
+
+        pthread_mutex_lock(&device->viewers_mutex);
+        timestamp = preview_pacer_frame(&device->pacer, fetch_start, fetch_end, fresh);
+        fresh = fresh && preview_fetch_data(&device->fetch, &image_data, &data_size);
+        resized = fresh && device->lv_cached && device_check_size(device, image_data, data_size);
+        groups = NULL;
+        if (fresh) {
+            for (group = device->groups; group; group = group->next) {
+                group->refs++;
+                group->fetch_next = groups;
+                groups = group;
+            }
+        }
+        pthread_mutex_unlock(&device->viewers_mutex);
+
+        if (resized) {
+            /* Only this thread changes the live view size once it runs. */
+            size.width = device->lv_width;
+            size.height = device->lv_height;
+            size.jpeg = device->lv_jpeg;
+            gphoto_sizes_set(device->model, GPHOTO_SIZES_LIVE_VIEW, &size);
+        }
+        for (group = groups; group; group = group->fetch_next) {
+            if (resized) {
+                group_stop(group);
+                group_start(device, group);
+            }
+            preview_session_queue(&group->session, image_data, data_size, timestamp);
+        }
+        if (groups) {
+            device_release_groups(device, groups);
+        }
+        gphoto_stats_log(&device->stats, device->model, fetch_end);
+    }
+
+    return NULL;
+}
+
+struct device_probe_call {
+    struct gphoto_device *device;
+    bool ret;
+};
+
+static bool device_probe_live_view(struct gphoto_device *device) {
+    struct gphoto_frame_size size = {0};
+    const uint8_t *image_data;
+    size_t data_size;
+
+    if (gphoto_sizes_get(device->model, GPHOTO_SIZES_LIVE_VIEW, &size)) {
+        /* Skips the probe frame, the fetch thread checks the first real one. */
+        device->lv_cached = true;
+    } else if (preview_fetch_capture(&device->fetch, device->camera, device->context) < GP_OK) {
+        blog(LOG_WARNING, "Can't capture preview.\n");
+        return false;
+    } else if (!preview_fetch_data(&device->fetch, &image_data, &data_size) ||
+               !gphoto_image_size(image_data, data_size, &size.width, &size.height)) {
+        return false;
+    } else {
+        size.jpeg = gphoto_jpeg_is_jpeg(image_data, data_size);
+        device->lv_cached = false;
+        gphoto_sizes_set(device->model, GPHOTO_SIZES_LIVE_VIEW, &size);
+    }
+    device->lv_width = size.width;
+    device->lv_height = size.height;
+    device->lv_jpeg = size.jpeg;
+    return true;
+}
+
+static void device_probe_command(void *vptr) {
+    struct device_probe_call *call = vptr;
+
+    call->ret = device_probe_live_view(call->device);
+}
+
+/*
+ * Called with the viewers lock held. Returns the viewer's group when it was the last viewer and no
+ * frame holds the group any more, for the caller to destroy without the lock.
+ */
+static struct gphoto_decode_group *device_remove_viewer(struct gphoto_device *device, struct gphoto_viewer *viewer) {
+    struct gphoto_decode_group *group = viewer->group, **group_link;
+    struct gphoto_viewer **link;
+
+    pthread_mutex_lock(&group->mutex);
+    for (link = &group->viewers; *link != viewer; link = &(*link)->next);
+    *link = viewer->next;
+    pthread_mutex_unlock(&group->mutex);
+    viewer->group = NULL;
+    viewer->next = NULL;
+
+    /* The fetch thread may still hand the group a frame, the last reference ends it. */
+    if (!group->viewers) {
+        for (group_link = &device->groups; *group_link != group; group_link = &(*group_link)->next);
+        *group_link = group->next;
+        if (!--group->refs) {
+            return group;
+        }
+    }
+    return NULL;
+}
+
+/* The first viewer starts the live view. Viewers that can't share an existing decode get their own. */
+bool gphoto_device_watch(struct gphoto_device *device, struct gphoto_viewer *viewer) {
+    struct gphoto_decode_group *group;
+    struct device_probe_call probe = {.device = device};
+    bool started = false;
+
+    pthread_mutex_lock(&device->live_mutex);
+    if (!device->fetching) {
+        if (preview_fetch_init(&device->fetch)) {
+            gphoto_executor_call(&device->executor, GPHOTO_PRIORITY_USER, device_probe_command, &probe);
+            started = probe.ret;
+        }
+        if (!started) {
+            preview_fetch_free(&device->fetch);
+            pthread_mutex_unlock(&device->live_mutex);
+            return false;
+        }
+        gphoto_stats_reset(&device->stats);
+        preview_pacer_init(&device->pacer, viewer->pacing, viewer->fps);
+    }
+
+    pthread_mutex_lock(&device->viewers_mutex);
+    for (group = device->groups; group; group = group->next) {
+        if (group->format == viewer->format && group->scale == viewer->scale && group->depth == viewer->depth) {
+            break;
+        }
+    }
+    if (!group) {
+        group = group_create(device, viewer);
+        group->next = device->groups;
+        device->groups = group;
+    }
+    pthread_mutex_lock(&group->mutex);
+    viewer->group = group;
+    viewer->next = group->viewers;
+    group->viewers = viewer;
+    pthread_mutex_unlock(&group->mutex);
+    group_set_viewer_size(device, group, viewer);
+    device_retune(device);
+    pthread_mutex_unlock(&device->viewers_mutex);
+
+    if (started) {
+        device->fetch_stop = false;
+        device->fetching = pthread_create(&device->fetch_thread, NULL, device_fetch_thread, device) == 0;
+        if (!device->fetching) {
+            /* The first viewer, so nobody else shares its group or the fetch. */
+            blog(LOG_WARNING, "%s: can't start the live view thread.\n", device->model);
+            pthread_mutex_lock(&device->viewers_mutex);
+            group = device_remove_viewer(device, viewer);
+            device_retune(device);
+            pthread_mutex_unlock(&device->viewers_mutex);
+            if (group) {
+                group_destroy(group);
+            }
+            preview_fetch_free(&device->fetch);
+        }
+    }
+    pthread_mutex_unlock(&device->live_mutex);
+
+    return !started || device->fetching;
+}
+
+/* The last viewer of a group ends its decode, the last one of all the live view. */
+void gphoto_device_unwatch(struct gphoto_device *device, struct gphoto_viewer *viewer) {
+    struct gphoto_decode_group *group;
+    bool stop;
+
+    if (!viewer->group) {
+        return;
+    }
+
+    pthread_mutex_lock(&device->live_mutex);
+    pthread_mutex_lock(&device->viewers_mutex);
+    group = device_remove_viewer(device, viewer);
+    device_retune(device);
+    stop = device->fetching && !device->groups;
+    if (stop) {
+        device->fetch_stop = true;
+    }
+    pthread_mutex_unlock(&device->viewers_mutex);
+
+    if (group) {
+        group_destroy(group);
+    }
+
+    if (stop) {
+        pthread_join(device->fetch_thread, NULL);
+        device->fetching = false;
+        preview_fetch_free(&device->fetch);
+    }
+    pthread_mutex_unlock(&device->live_mutex);
+}
+
+void gphoto_device_set_pacing(struct gphoto_device *device, struct gphoto_viewer *viewer, long long fps,
+                              enum preview_pacing pacing) {
+    pthread_mutex_lock(&device->viewers_mutex);
+    viewer->fps = fps;
+    viewer->pacing = pacing;
+    device_retune(device);
+    pthread_mutex_unlock(&device->viewers_mutex);
+}
+
+bool gphoto_device_watched(struct gphoto_device *device) {
+    bool ret;
+
+    pthread_mutex_lock(&device->viewers_mutex);
+    ret = device->groups != NULL;
+    pthread_mutex_unlock(&device->viewers_mutex);
+    return ret;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <obs-module.h>
+#include <pthread.h>
+#include <gphoto2/gphoto2-camera.h>
+
+#include "gphoto-backend.h"
+#include "gphoto-executor.h"
+#include "gphoto-pacing.h"
+#include "gphoto-session.h"
+#include "gphoto-stats.h"
+
+/* Photos the live view's event checks saw while a timelapse source takes them, kept until it polls. */
+#define GPHOTO_DEVICE_ADDED_FILES 8
+
+struct gphoto_device;
+struct gphoto_decode_group;
+
+/* A preview source watching the live view of a device. width and height are set by the device. */
+struct gphoto_viewer {
+    preview_output_t output;
+    void *param;
+    enum video_format format;
+    uint32_t scale;
+    size_t depth;
+    long long fps;
+    enum preview_pacing pacing;
+
+    uint32_t width;
+    uint32_t height;
+
+    struct gphoto_decode_group *group;
+    struct gphoto_viewer *next;
+};
+
+/*
+ * Viewers with the same output format, scale and decode depth share one decode. The device's list and
+ * a frame the fetch thread is handing out each hold a reference, counted under the viewers lock.
+ */
+struct gphoto_decode_group {
+    struct preview_session session;
+    enum video_format format;
+    uint32_t scale;
+    size_t depth;
+    long refs;
+
+    pthread_mutex_t mutex;
+    struct gphoto_viewer *viewers;
+    struct gphoto_decode_group *next;
+    /* Fetch thread only, the groups the current frame goes to. */
+    struct gphoto_decode_group *fetch_next;
+};
+
+/*
+ * One open camera, shared by every source that picked its model. Every call into the camera runs
+ * on its executor, so focus, config writes and stills go ahead of the next live view fetch and no
+ * OBS thread waits for USB. The live view runs while at least one viewer watches it: one fetch
+ * thread paces it and each decode group hands the frames to all of its viewers.
+ */
+struct gphoto_device {
+    char *model;
+    long refs;
+    bool gone;
+    struct gphoto_device *next;
+
+    struct gphoto_executor executor;
+    struct gphoto_camera *camera;
+    GPContext *context;
+    struct gphoto_stats stats;
+
+    /* Snapshot of the config tree for the property dialogs, only replaced by the executor. */
+    pthread_mutex_t config_mutex;
+    CameraWidget *config;
+    bool config_stale;
+    bool config_reload_queued;
+
+    /* Config values waiting to be written, by name. NULL while there are none. */
+    pthread_mutex_t writes_mutex;
+    obs_data_t *writes;
+
+    /* Held while live view starts or stops, the fetch thread never takes it. */
+    pthread_mutex_t live_mutex;
+    pthread_mutex_t viewers_mutex;
+    struct gphoto_decode_group *groups;
+    pthread_t fetch_thread;
+    bool fetching;
+    bool fetch_stop;
+    struct preview_fetch fetch;
+    struct preview_pacer pacer;
+
+    uint32_t lv_width;
+    uint32_t lv_height;
+    bool lv_jpeg;
+    bool lv_cached;
+
+    /* Executor only. */
+    uint64_t events_at;
+    long file_watchers;
+    CameraFilePath added[GPHOTO_DEVICE_ADDED_FILES];
+    size_t added_count;
+};
+
+void gphoto_devices_init(void);
+void gphoto_devices_free(void);
+
+/* Takes a reference, opening the camera if no other source has it open. NULL if it can't be opened. */
+struct gphoto_device *gphoto_device_open(const char *model);
+void gphoto_device_close(struct gphoto_device *device);
+
+/* Commands get the camera and context from the device, see gphoto-executor.h. */
+void gphoto_device_submit(struct gphoto_device *device, enum gphoto_priority priority, gphoto_command_t run,
+                          void *param);
+void gphoto_device_call(struct gphoto_device *device, enum gphoto_priority priority, gphoto_command_t run,
+                        void *param);
+void gphoto_device_flush(struct gphoto_device *device);
+
+/* The config tree for a dialog, may be NULL. Hold it only while reading. */
+CameraWidget *gphoto_device_config_lock(struct gphoto_device *device);
+void gphoto_device_config_unlock(struct gphoto_device *device);
+void gphoto_device_config_changed(struct gphoto_device *device);
+
+/*
+ * Executor only. gphoto_camera_wait_for_event that also marks the config tree stale on a change
+ * event. Photos the live view's event checks saw come first. data is freed with free().
+ */
+int gphoto_device_wait_for_event(struct gphoto_device *device, int timeout, CameraEventType *type, void **data);
+/* Queued like a config change. Photos taken before any source watches for them aren't handed out. */
+void gphoto_device_watch_files(struct gphoto_device *device, bool watch);
+
+/* These queue the change and return, it is sent to the camera ahead of the live view. */
+void gphoto_device_set_config(struct gphoto_device *device, obs_data_t *settings, const char *name);
+void gphoto_device_set_autofocus(struct gphoto_device *device, bool enabled);
+void gphoto_device_set_manualfocus(struct gphoto_device *device, const char *value);
+
+bool gphoto_device_watch(struct gphoto_device *device, struct gphoto_viewer *viewer);
+void gphoto_device_unwatch(struct gphoto_device *device, struct gphoto_viewer *viewer);
+void gphoto_device_set_pacing(struct gphoto_device *device, struct gphoto_viewer *viewer, long long fps,
+                              enum preview_pacing pacing);
+bool gphoto_device_watched(struct gphoto_device *device);
@@ -0,0 +1,261 @@
+#include <time.h>
+#include <pthread.h>
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "gphoto-discovery.h"
+#include "gphoto-utils.h"
+#include "gphoto-trace.h"
+#if HAVE_UDEV
+#include "gphoto-udev.h"
+#endif
+
+/* A scan waits until the events were quiet this long, but not longer than the maximum after the first one. */
+#define DISCOVERY_QUIET 250000000ULL
+#define DISCOVERY_MAX_DELAY 1000000000ULL
+
+static const char *discovery_signals[] = {
+        "void camera_added(string model, string port)",
+        "void camera_removed(string model, string port)",
+        NULL
+};
+
+static pthread_t discovery_thread;
+static pthread_mutex_t discovery_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t discovery_cond;
+static bool discovery_started = false;
+static bool discovery_stop = false;
+static bool discovery_pending = false;
+static uint64_t discovery_first_request = 0;
+static uint64_t discovery_due = 0;
+
+static CameraList *cameras = NULL;
+static signal_handler_t *discovery_signalhandler = NULL;
+
+static bool list_contains(CameraList *list, const char *model, const char *port) {
+    const char *name, *value;
+    int i, count = gp_list_count(list);
+
+    for (i = 0; i < count; i++) {
+        gp_list_get_name(list, i, &name);
+        gp_list_get_value(list, i, &value);
+        if ((!model || strcmp(name, model) == 0) && (!port || strcmp(value, port) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void discovery_emit(const char *signal, const char *model, const char *port) {
+    calldata_t data;
+
+    calldata_init(&data);
+    calldata_set_string(&data, "model", model);
+    calldata_set_string(&data, "port", port);
+    signal_handler_signal(discovery_signalhandler, signal, &data);
+    calldata_free(&data);
+}
+
+/* Every camera of old missing in new is signalled as removed, the other way round as added. */
+static void discovery_publish(CameraList *old, CameraList *new) {
+    const char *model, *port;
+    int i, count;
+
+    count = gp_list_count(old);
+    for (i = 0; i < count; i++) {
+        gp_list_get_name(old, i, &model);
+        gp_list_get_value(old, i, &port);
+        if (!list_contains(new, model, port)) {
+            blog(LOG_INFO, "Camera removed: %s at %s.\n", model, port);
+            discovery_emit("camera_removed", model, port);
+        }
+    }
+    count = gp_list_count(new);
+    for (i = 0; i < count; i++) {
+        gp_list_get_name(new, i, &model);
+        gp_list_get_value(new, i, &port);
+        if (!list_contains(old, model, port)) {
+            blog(LOG_INFO, "Camera added: %s at %s.\n", model, port);
+            discovery_emit("camera_added", model, port);
+        }
+    }
+}
+
+static void discovery_scan(GPContext *context) {
+    CameraList *found = NULL, *old;
+
+    gp_list_new(&found);
+    if (gphoto_cam_list(found, context) < GP_OK) {
+        blog(LOG_WARNING, "Can't autodetect cameras.\n");
+        gp_list_free(found);
+        return;
+    }
+
+    pthread_mutex_lock(&discovery_mutex);
+    old = cameras;
+    cameras = found;
+    pthread_mutex_unlock(&discovery_mutex);
+
+    /* Only this thread replaces the list, old stays valid here. */
+    discovery_publish(old, found);
+    gp_list_free(old);
+}
+
+static void discovery_wait_until(uint64_t deadline) {
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(deadline / 1000000000ULL);
+    ts.tv_nsec = (long)(deadline % 1000000000ULL);
+    pthread_cond_timedwait(&discovery_cond, &discovery_mutex, &ts);
+}
+
+static void *discovery_thread_main(void *vptr) {
+    UNUSED_PARAMETER(vptr);
+    GPContext *context = gp_context_new();
+    uint64_t deadline, max_deadline;
+
+    gphoto_trace_thread_name("camera discovery");
+    pthread_mutex_lock(&discovery_mutex);
+    while (!discovery_stop) {
+        if (!discovery_pending) {
+            pthread_cond_wait(&discovery_cond, &discovery_mutex);
+            continue;
+        }
+
+        deadline = discovery_due;
+        max_deadline = discovery_first_request + DISCOVERY_MAX_DELAY;
+        if (deadline > max_deadline) {
+            deadline = max_deadline;
+        }
+        if (os_gettime_ns() < deadline) {
+            discovery_wait_until(deadline);
+            continue;
+        }
+
+        discovery_pending = false;
+        pthread_mutex_unlock(&discovery_mutex);
+        discovery_scan(context);
+        pthread_mutex_lock(&discovery_mutex);
+    }
+    pthread_mutex_unlock(&discovery_mutex);
+
+    gp_context_unref(context);
+    return NULL;
+}
+
+/* Called with the mutex held. */
+static void discovery_request(uint64_t delay) {
+    uint64_t now = os_gettime_ns();
+
+    if (!discovery_pending) {
+        discovery_pending = true;
+        discovery_first_request = now;
+    }
+    discovery_due = now + delay;
+    pthread_cond_signal(&discovery_cond);
+}
+
+void gphoto_discovery_refresh(void) {
+    pthread_mutex_lock(&discovery_mutex);
+    discovery_request(DISCOVERY_QUIET);
+    pthread_mutex_unlock(&discovery_mutex);
+}
+
+#if HAVE_UDEV
+/* udev only passes devices that may be cameras, whether it is one only a scan can tell. */
+static void discovery_udev_added(void *vptr, calldata_t *calldata) {
+    UNUSED_PARAMETER(vptr);
+    UNUSED_PARAMETER(calldata);
+
+    gphoto_discovery_refresh();
+}
+
+/* A device gone from a port none of the listed cameras is on changes nothing. */
+static void discovery_udev_removed(void *vptr, calldata_t *calldata) {
+    UNUSED_PARAMETER(vptr);
+    const char *port = calldata_string(calldata, "port");
+
+    pthread_mutex_lock(&discovery_mutex);
+    if (port && list_contains(cameras, NULL, port)) {
+        discovery_request(DISCOVERY_QUIET);
+    }
+    pthread_mutex_unlock(&discovery_mutex);
+}
+#endif
+
+void gphoto_discovery_init(void) {
+    pthread_condattr_t attr;
+
+    gp_list_new(&cameras);
+    discovery_signalhandler = signal_handler_create();
+    signal_handler_add_array(discovery_signalhandler, discovery_signals);
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&discovery_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    /* The first scan runs at once, sources created meanwhile get their cameras as camera_added. */
+    discovery_stop = false;
+    discovery_request(0);
+    discovery_started = pthread_create(&discovery_thread, NULL, discovery_thread_main, NULL) == 0;
+
+#if HAVE_UDEV
+    gphoto_init_udev();
+    signal_handler_t *sh = gphoto_get_udev_signalhandler();
+    signal_handler_connect(sh, "device_added", discovery_udev_added, NULL);
+    signal_handler_connect(sh, "device_removed", discovery_udev_removed, NULL);
+#endif
+}
+
+void gphoto_discovery_free(void) {
+#if HAVE_UDEV
+    signal_handler_t *sh = gphoto_get_udev_signalhandler();
+    signal_handler_disconnect(sh, "device_added", discovery_udev_added, NULL);
+    signal_handler_disconnect(sh, "device_removed", discovery_udev_removed, NULL);
+    gphoto_unref_udev();
+#endif
+
+    if (discovery_started) {
+        pthread_mutex_lock(&discovery_mutex);
+        discovery_stop = true;
+        pthread_cond_signal(&discovery_cond);
+        pthread_mutex_unlock(&discovery_mutex);
+        pthread_join(discovery_thread, NULL);
+        discovery_started = false;
+    }
+    pthread_cond_destroy(&discovery_cond);
+
+    signal_handler_destroy(discovery_signalhandler);
+    discovery_signalhandler = NULL;
+    gp_list_free(cameras);
+    cameras = NULL;
+}
+
+signal_handler_t *gphoto_discovery_signalhandler(void) {
+    return discovery_signalhandler;
+}
+
+void gphoto_discovery_list(CameraList *list) {
+    const char *model, *port;
+    int i, count;
+
+    gp_list_reset(list);
+    pthread_mutex_lock(&discovery_mutex);
+    count = gp_list_count(cameras);
+    for (i = 0; i < count; i++) {
+        gp_list_get_name(cameras, i, &model);
+        gp_list_get_value(cameras, i, &port);
+        gp_list_append(list, model, port);
+    }
+    pthread_mutex_unlock(&discovery_mutex);
+}
+
+bool gphoto_discovery_has(const char *model) {
+    bool ret;
+
+    pthread_mutex_lock(&discovery_mutex);
+    ret = list_contains(cameras, model, NULL);
+    pthread_mutex_unlock(&discovery_mutex);
+    return ret;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <obs-module.h>
+#include <gphoto2/gphoto2-camera.h>
+
+/*
+ * One camera list for the whole module. A background thread runs the autodetection: once at module
+ * load, then once per burst of udev events (a plug produces several) and on request. Changes are
+ * published as camera_added / camera_removed signals with the model and port of each camera, from
+ * the discovery thread.
+ */
+void gphoto_discovery_init(void);
+void gphoto_discovery_free(void);
+
+signal_handler_t *gphoto_discovery_signalhandler(void);
+
+/* Copies the current list into list, names are models and values ports like gp_camera_autodetect. */
+void gphoto_discovery_list(CameraList *list);
+bool gphoto_discovery_has(const char *model);
+
+/* Asks for another scan, e.g. after a failed open. Requests close together share one scan. */
+void gphoto_discovery_refresh(void);
@@ -0,0 +1,127 @@
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "gphoto-executor.h"
+#include "gphoto-trace.h"
+
+/* Called with the mutex held. */
+static struct gphoto_command *executor_next(struct gphoto_executor *executor) {
+    struct gphoto_command *command;
+    int priority;
+
+    for (priority = 0; priority < GPHOTO_PRIORITY_COUNT; priority++) {
+        command = executor->head[priority];
+        if (command) {
+            executor->head[priority] = command->next;
+            if (!command->next) {
+                executor->tail[priority] = NULL;
+            }
+            return command;
+        }
+    }
+    return NULL;
+}
+
+static void *executor_thread(void *vptr) {
+    struct gphoto_executor *executor = vptr;
+    struct gphoto_command *command;
+
+    gphoto_trace_thread_name("camera executor");
+    pthread_mutex_lock(&executor->mutex);
+    for (;;) {
+        command = executor_next(executor);
+        if (!command) {
+            if (executor->stop) {
+                break;
+            }
+            pthread_cond_wait(&executor->cond, &executor->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&executor->mutex);
+
+        gphoto_trace_span("queue wait", command->queued, os_gettime_ns());
+        command->run(command->param);
+        if (command->done) {
+            os_event_signal(command->done);
+        } else {
+            bfree(command);
+        }
+
+        pthread_mutex_lock(&executor->mutex);
+    }
+    pthread_mutex_unlock(&executor->mutex);
+
+    return NULL;
+}
+
+void gphoto_executor_init(struct gphoto_executor *executor) {
+    memset(executor, 0, sizeof(struct gphoto_executor));
+    pthread_mutex_init(&executor->mutex, NULL);
+    pthread_cond_init(&executor->cond, NULL);
+    executor->started = pthread_create(&executor->thread, NULL, executor_thread, executor) == 0;
+}
+
+void gphoto_executor_free(struct gphoto_executor *executor) {
+    if (executor->started) {
+        pthread_mutex_lock(&executor->mutex);
+        executor->stop = true;
+        pthread_cond_signal(&executor->cond);
+        pthread_mutex_unlock(&executor->mutex);
+        pthread_join(executor->thread, NULL);
+        executor->started = false;
+    }
+    pthread_cond_destroy(&executor->cond);
+    pthread_mutex_destroy(&executor->mutex);
+}
+
+static void executor_queue(struct gphoto_executor *executor, enum gphoto_priority priority,
+                           struct gphoto_command *command) {
+    command->queued = os_gettime_ns();
+    command->next = NULL;
+
+    pthread_mutex_lock(&executor->mutex);
+    if (executor->tail[priority]) {
+        executor->tail[priority]->next = command;
+    } else {
+        executor->head[priority] = command;
+    }
+    executor->tail[priority] = command;
+    pthread_cond_signal(&executor->cond);
+    pthread_mutex_unlock(&executor->mutex);
+}
+
+void gphoto_executor_submit(struct gphoto_executor *executor, enum gphoto_priority priority, gphoto_command_t run,
+                            void *param) {
+    struct gphoto_command *command = bzalloc(sizeof(struct gphoto_command));
+
+    command->run = run;
+    command->param = param;
+    executor_queue(executor, priority, command);
+}
+
+void gphoto_executor_call(struct gphoto_executor *executor, enum gphoto_priority priority, gphoto_command_t run,
+                          void *param) {
+    struct gphoto_command command = {0};
+
+    /* A command calling into its own executor would wait for itself. */
+    if (!executor->started || pthread_equal(pthread_self(), executor->thread)) {
+        run(param);
+        return;
+    }
+
+    command.run = run;
+    command.param = param;
+    os_event_init(&command.done, OS_EVENT_TYPE_MANUAL);
+    executor_queue(executor, priority, &command);
+    os_event_wait(command.done);
+    os_event_destroy(command.done);
+}
+
+static void executor_nothing(void *param) {
+    UNUSED_PARAMETER(param);
+}
+
+/* The lowest priority runs after everything queued before it. */
+void gphoto_executor_flush(struct gphoto_executor *executor) {
+    gphoto_executor_call(executor, GPHOTO_PRIORITY_POLL, executor_nothing, NULL);
+}
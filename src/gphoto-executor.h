@@ -0,0 +1,50 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <util/threading.h>
+
+/* Most urgent first: someone clicked, a photo is due, the routine polls. */
+enum gphoto_priority {
+    GPHOTO_PRIORITY_USER,
+    GPHOTO_PRIORITY_CAPTURE,
+    GPHOTO_PRIORITY_POLL,
+    GPHOTO_PRIORITY_COUNT,
+};
+
+typedef void (*gphoto_command_t)(void *param);
+
+struct gphoto_command {
+    gphoto_command_t run;
+    void *param;
+    uint64_t queued;
+    os_event_t *done;
+    struct gphoto_command *next;
+};
+
+/*
+ * The one thread that talks to a camera. Commands run one at a time, the queued one with the most
+ * urgent priority first and in submission order within a priority. submit returns at once and the
+ * command finishes its own work, call waits for it like a future.
+ */
+struct gphoto_executor {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct gphoto_command *head[GPHOTO_PRIORITY_COUNT];
+    struct gphoto_command *tail[GPHOTO_PRIORITY_COUNT];
+    bool started;
+    bool stop;
+};
+
+void gphoto_executor_init(struct gphoto_executor *executor);
+/* Runs what is still queued, then stops. */
+void gphoto_executor_free(struct gphoto_executor *executor);
+
+void gphoto_executor_submit(struct gphoto_executor *executor, enum gphoto_priority priority, gphoto_command_t run,
+                            void *param);
+void gphoto_executor_call(struct gphoto_executor *executor, enum gphoto_priority priority, gphoto_command_t run,
+                          void *param);
+/* Waits until everything submitted before has run. */
+void gphoto_executor_flush(struct gphoto_executor *executor);
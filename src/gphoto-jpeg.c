@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "gphoto-jpeg.h"
+#include "gphoto-convert.h"
+
+/* Some cameras pad live view frames after the EOI marker, so don't expect it in the very last bytes. */
+#define JPEG_EOI_SEARCH 64
+
+struct jpeg_error {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+/* Kept for the whole stream, so steady state decoding doesn't create libjpeg objects per frame. */
+struct gphoto_jpeg_decoder {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error jerr;
+
+    uint8_t *scratch;
+    size_t scratch_size;
+    long allocs;
+
+    /* Time the last decode spent in separate colour conversion or chroma passes, 0 when fused. */
+    uint64_t convert_time;
+};
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    struct jpeg_error *err = (struct jpeg_error *)cinfo->err;
+    char message[JMSG_LENGTH_MAX];
+
+    cinfo->err->format_message(cinfo, message);
+    blog(LOG_WARNING, "JPEG error: %s.\n", message);
+    longjmp(err->jump, 1);
+}
+
+static void jpeg_output_message(j_common_ptr cinfo) {
+    UNUSED_PARAMETER(cinfo);
+}
+
+bool gphoto_jpeg_is_jpeg(const uint8_t *data, size_t size) {
+    return data && size >= 4 && data[0] == 0xFF && data[1] == 0xD8;
+}
+
+bool gphoto_jpeg_is_complete(const uint8_t *data, size_t size) {
+    size_t i, stop;
+
+    if (!gphoto_jpeg_is_jpeg(data, size)) {
+        return false;
+    }
+
+    stop = size > JPEG_EOI_SEARCH ? size - JPEG_EOI_SEARCH : 2;
+    for (i = size - 1; i > stop; i--) {
+        if (data[i - 1] == 0xFF && data[i] == 0xD9) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool gphoto_jpeg_read_size(const uint8_t *data, size_t size, uint32_t *width, uint32_t *height) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error jerr;
+    bool ret = false;
+
+    if (!gphoto_jpeg_is_jpeg(data, size)) {
+        return false;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpeg_error_exit;
+    jerr.pub.output_message = jpeg_output_message;
+    if (setjmp(jerr.jump)) {
+        goto out;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *)data, (unsigned long)size);
+    jpeg_read_header(&cinfo, TRUE);
+    *width = cinfo.image_width;
+    *height = cinfo.image_height;
+    ret = true;
+
+    out:
+    jpeg_destroy_decompress(&cinfo);
+    return ret;
+}
+
+struct gphoto_jpeg_decoder *gphoto_jpeg_decoder_create(void) {
+    struct gphoto_jpeg_decoder *decoder = bzalloc(sizeof(struct gphoto_jpeg_decoder));
+
+    decoder->cinfo.err = jpeg_std_error(&decoder->jerr.pub);
+    decoder->jerr.pub.error_exit = jpeg_error_exit;
+    decoder->jerr.pub.output_message = jpeg_output_message;
+    jpeg_create_decompress(&decoder->cinfo);
+    return decoder;
+}
+
+void gphoto_jpeg_decoder_destroy(struct gphoto_jpeg_decoder *decoder) {
+    if (decoder) {
+        jpeg_destroy_decompress(&decoder->cinfo);
+        bfree(decoder->scratch);
+        bfree(decoder);
+    }
+}
+
+long gphoto_jpeg_decoder_allocs(const struct gphoto_jpeg_decoder *decoder) {
+    return decoder->allocs;
+}
+
+uint64_t gphoto_jpeg_decoder_convert_time(const struct gphoto_jpeg_decoder *decoder) {
+    return decoder->convert_time;
+}
+
+static uint8_t *decoder_scratch(struct gphoto_jpeg_decoder *decoder, size_t size) {
+    if (decoder->scratch_size < size) {
+        bfree(decoder->scratch);
+        decoder->scratch = bmalloc(size);
+        decoder->scratch_size = size;
+        decoder->allocs++;
+    }
+    return decoder->scratch;
+}
+
+bool gphoto_jpeg_decode_bgra(struct gphoto_jpeg_decoder *decoder, const uint8_t *data, size_t size,
+                             uint32_t scale, uint32_t width, uint32_t height, uint8_t *out, uint32_t linesize) {
+    struct jpeg_decompress_struct *cinfo = &decoder->cinfo;
+    JSAMPROW row;
+#ifndef JCS_EXTENSIONS
+    uint8_t *dst;
+    uint64_t start;
+#endif
+
+    decoder->convert_time = 0;
+    if (setjmp(decoder->jerr.jump)) {
+        goto fail;
+    }
+
+    jpeg_mem_src(cinfo, (unsigned char *)data, (unsigned long)size);
+    jpeg_read_header(cinfo, TRUE);
+
+    /*
+     * libjpeg-turbo converts to BGRA in the same pass as upsampling, which beats a YCbCr pass plus the
+     * convert kernels. Plain libjpeg only upsamples and the kernels do the conversion and swizzle.
+     */
+#ifdef JCS_EXTENSIONS
+    cinfo->out_color_space = JCS_EXT_BGRA;
+#else
+    cinfo->out_color_space = cinfo->jpeg_color_space == JCS_YCbCr ? JCS_YCbCr : JCS_RGB;
+#endif
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = scale;
+    jpeg_start_decompress(cinfo);
+
+    if (cinfo->output_width != width || cinfo->output_height != height) {
+        blog(LOG_WARNING, "JPEG size %ux%u doesn't match frame size %ux%u.\n",
+             cinfo->output_width, cinfo->output_height, width, height);
+        goto fail;
+    }
+
+#ifdef JCS_EXTENSIONS
+    /* Decode straight into the caller's buffer, no intermediate image. */
+    while (cinfo->output_scanline < cinfo->output_height) {
+        row = out + (size_t)cinfo->output_scanline * linesize;
+        jpeg_read_scanlines(cinfo, &row, 1);
+    }
+#else
+    /* Convert every scanline while it is still in cache. */
+    row = decoder_scratch(decoder, (size_t)width * 3);
+    while (cinfo->output_scanline < cinfo->output_height) {
+        dst = out + (size_t)cinfo->output_scanline * linesize;
+        jpeg_read_scanlines(cinfo, &row, 1);
+        start = os_gettime_ns();
+        if (cinfo->out_color_space == JCS_YCbCr) {
+            gphoto_convert->ycbcr_to_bgrx(row, dst, width);
+        } else {
+            gphoto_convert->rgb_to_bgra(row, dst, width);
+        }
+        decoder->convert_time += os_gettime_ns() - start;
+    }
+#endif
+
+    jpeg_finish_decompress(cinfo);
+    return true;
+
+    fail:
+    /* Leaves the decompressor ready for the next frame. */
+    jpeg_abort_decompress(cinfo);
+    return false;
+}
+
+/*
+ * Raw (planar) decoding writes whole DCT blocks, so planes are padded to the MCU size. Live view
+ * is 4:2:0 or 4:2:2, an MCU is never larger than 16x16.
+ */
+#define JPEG_MCU_ALIGN(x) (((x) + 15) & ~15u)
+
+void gphoto_jpeg_i420_layout(uint32_t width, uint32_t height, uint32_t linesize[3], uint32_t plane_height[3]) {
+    linesize[0] = JPEG_MCU_ALIGN(width);
+    linesize[1] = linesize[2] = linesize[0] / 2;
+    plane_height[0] = JPEG_MCU_ALIGN(height);
+    plane_height[1] = plane_height[2] = plane_height[0] / 2;
+}
+
+uint32_t gphoto_jpeg_scaled(uint32_t size, uint32_t scale) {
+    return (size + scale - 1) / scale;
+}
+
+/*
+ * Downscaled decode: libjpeg scales chroma up in the IDCT instead of upsampling, so ask for
+ * interleaved YCbCr (no colour conversion) and subsample chroma 2x2 while splitting the planes.
+ */
+static bool decode_i420_scaled(struct gphoto_jpeg_decoder *decoder, uint8_t *planes[3],
+                               const uint32_t linesize[3]) {
+    struct jpeg_decompress_struct *cinfo = &decoder->cinfo;
+    uint32_t width = cinfo->output_width;
+    uint32_t y, row_size = width * 3;
+    uint8_t *scratch = decoder_scratch(decoder, 2 * (size_t)row_size);
+    JSAMPROW rows[2] = {scratch, scratch + row_size};
+    uint8_t *luma;
+    uint64_t start;
+
+    for (y = 0; cinfo->output_scanline < cinfo->output_height; y += 2) {
+        jpeg_read_scanlines(cinfo, &rows[0], 1);
+        if (cinfo->output_scanline < cinfo->output_height) {
+            jpeg_read_scanlines(cinfo, &rows[1], 1);
+        } else {
+            memcpy(rows[1], rows[0], row_size);
+        }
+
+        start = os_gettime_ns();
+        luma = planes[0] + (size_t)y * linesize[0];
+        gphoto_convert->ycbcr_to_i420(rows[0], rows[1], luma, luma + linesize[0],
+                                      planes[1] + (size_t)(y / 2) * linesize[1],
+                                      planes[2] + (size_t)(y / 2) * linesize[2], width);
+        decoder->convert_time += os_gettime_ns() - start;
+    }
+    return true;
+}
+
+bool gphoto_jpeg_decode_i420(struct gphoto_jpeg_decoder *decoder, const uint8_t *data, size_t size,
+                             uint32_t scale, uint32_t width, uint32_t height, uint8_t *planes[3],
+                             const uint32_t linesize[3]) {
+    struct jpeg_decompress_struct *cinfo = &decoder->cinfo;
+    JSAMPROW rows[3][2 * DCTSIZE];
+    JSAMPARRAY image[3] = {rows[0], rows[1], rows[2]};
+    uint8_t *scratch = NULL;
+    uint32_t y, c, i, imcu_rows, chroma_rows;
+    uint64_t start;
+
+    decoder->convert_time = 0;
+    if (setjmp(decoder->jerr.jump)) {
+        goto fail;
+    }
+
+    jpeg_mem_src(cinfo, (unsigned char *)data, (unsigned long)size);
+    jpeg_read_header(cinfo, TRUE);
+
+    if (gphoto_jpeg_scaled(cinfo->image_width, scale) != width ||
+        gphoto_jpeg_scaled(cinfo->image_height, scale) != height) {
+        blog(LOG_WARNING, "JPEG size %ux%u (1/%u) doesn't match frame size %ux%u.\n",
+             cinfo->image_width, cinfo->image_height, scale, width, height);
+        goto fail;
+    }
+    if (cinfo->num_components != 3 || cinfo->jpeg_color_space != JCS_YCbCr) {
+        blog(LOG_WARNING, "Unsupported JPEG colour space for YUV output.\n");
+        goto fail;
+    }
+
+    if (scale > 1) {
+        cinfo->out_color_space = JCS_YCbCr;
+        cinfo->scale_num = 1;
+        cinfo->scale_denom = scale;
+        jpeg_start_decompress(cinfo);
+        decode_i420_scaled(decoder, planes, linesize);
+        jpeg_finish_decompress(cinfo);
+        return true;
+    }
+
+    if (cinfo->comp_info[0].h_samp_factor != 2 || cinfo->comp_info[0].v_samp_factor > 2 ||
+        cinfo->comp_info[1].h_samp_factor != 1 || cinfo->comp_info[1].v_samp_factor != 1 ||
+        cinfo->comp_info[2].h_samp_factor != 1 || cinfo->comp_info[2].v_samp_factor != 1) {
+        blog(LOG_WARNING, "Unsupported JPEG chroma subsampling for YUV output.\n");
+        goto fail;
+    }
+
+    cinfo->raw_data_out = TRUE;
+    jpeg_start_decompress(cinfo);
+
+    imcu_rows = (uint32_t)cinfo->max_v_samp_factor * DCTSIZE;
+    chroma_rows = DCTSIZE;
+
+    /* 4:2:2 has full height chroma, halve it vertically into a scratch block first. */
+    if (cinfo->max_v_samp_factor == 1) {
+        scratch = decoder_scratch(decoder, 2 * DCTSIZE * linesize[1]);
+    }
+
+    for (y = 0; cinfo->output_scanline < cinfo->output_height; y += imcu_rows) {
+        for (i = 0; i < imcu_rows; i++) {
+            rows[0][i] = planes[0] + (size_t)(y + i) * linesize[0];
+        }
+        for (c = 1; c < 3; c++) {
+            for (i = 0; i < chroma_rows; i++) {
+                if (scratch) {
+                    rows[c][i] = scratch + (size_t)((c - 1) * DCTSIZE + i) * linesize[c];
+                } else {
+                    rows[c][i] = planes[c] + (size_t)(y / 2 + i) * linesize[c];
+                }
+            }
+        }
+
+        jpeg_read_raw_data(cinfo, image, imcu_rows);
+
+        if (scratch) {
+            start = os_gettime_ns();
+            for (c = 1; c < 3; c++) {
+                for (i = 0; i < chroma_rows; i += 2) {
+                    gphoto_convert->average_rows(planes[c] + (size_t)(y / 2 + i / 2) * linesize[c],
+                                 rows[c][i], rows[c][i + 1], linesize[c]);
+                }
+            }
+            decoder->convert_time += os_gettime_ns() - start;
+        }
+    }
+
+    jpeg_finish_decompress(cinfo);
+    return true;
+
+    fail:
+    jpeg_abort_decompress(cinfo);
+    return false;
+}
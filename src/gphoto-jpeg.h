@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct gphoto_jpeg_decoder;
+
+struct gphoto_jpeg_decoder *gphoto_jpeg_decoder_create(void);
+void gphoto_jpeg_decoder_destroy(struct gphoto_jpeg_decoder *decoder);
+long gphoto_jpeg_decoder_allocs(const struct gphoto_jpeg_decoder *decoder);
+uint64_t gphoto_jpeg_decoder_convert_time(const struct gphoto_jpeg_decoder *decoder);
+
+bool gphoto_jpeg_is_jpeg(const uint8_t *data, size_t size);
+bool gphoto_jpeg_is_complete(const uint8_t *data, size_t size);
+uint32_t gphoto_jpeg_scaled(uint32_t size, uint32_t scale);
+bool gphoto_jpeg_read_size(const uint8_t *data, size_t size, uint32_t *width, uint32_t *height);
+bool gphoto_jpeg_decode_bgra(struct gphoto_jpeg_decoder *decoder, const uint8_t *data, size_t size,
+                             uint32_t scale, uint32_t width, uint32_t height, uint8_t *out, uint32_t linesize);
+
+void gphoto_jpeg_i420_layout(uint32_t width, uint32_t height, uint32_t linesize[3], uint32_t plane_height[3]);
+bool gphoto_jpeg_decode_i420(struct gphoto_jpeg_decoder *decoder, const uint8_t *data, size_t size,
+                             uint32_t scale, uint32_t width, uint32_t height, uint8_t *planes[3],
+                             const uint32_t linesize[3]);
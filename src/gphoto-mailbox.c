@@ -0,0 +1,50 @@
+#include <obs-module.h>
+
+#include "gphoto-mailbox.h"
+
+static void still_free(struct gphoto_still *still) {
+    if (still) {
+        bfree(still->data);
+        bfree(still);
+    }
+}
+
+/* Both sides only ever exchange whole slots, a buffer pushed out of the spare slot is freed. */
+struct gphoto_still *gphoto_mailbox_acquire(struct gphoto_mailbox *mailbox, uint32_t width, uint32_t height) {
+    struct gphoto_still *still = __atomic_exchange_n(&mailbox->spare, NULL, __ATOMIC_ACQUIRE);
+    size_t size = (size_t)width * height * 4;
+
+    if (!still) {
+        still = bzalloc(sizeof(struct gphoto_still));
+    }
+    if (still->capacity < size) {
+        bfree(still->data);
+        still->data = bmalloc(size);
+        still->capacity = size;
+    }
+    still->width = width;
+    still->height = height;
+    return still;
+}
+
+void gphoto_mailbox_post(struct gphoto_mailbox *mailbox, struct gphoto_still *still) {
+    struct gphoto_still *old = __atomic_exchange_n(&mailbox->full, still, __ATOMIC_ACQ_REL);
+
+    /* Never shown, the consumer may have put back a buffer meanwhile. */
+    if (old) {
+        still_free(__atomic_exchange_n(&mailbox->spare, old, __ATOMIC_ACQ_REL));
+    }
+}
+
+struct gphoto_still *gphoto_mailbox_take(struct gphoto_mailbox *mailbox) {
+    return __atomic_exchange_n(&mailbox->full, NULL, __ATOMIC_ACQUIRE);
+}
+
+void gphoto_mailbox_release(struct gphoto_mailbox *mailbox, struct gphoto_still *still) {
+    still_free(__atomic_exchange_n(&mailbox->spare, still, __ATOMIC_ACQ_REL));
+}
+
+void gphoto_mailbox_free(struct gphoto_mailbox *mailbox) {
+    still_free(__atomic_exchange_n(&mailbox->full, NULL, __ATOMIC_ACQUIRE));
+    still_free(__atomic_exchange_n(&mailbox->spare, NULL, __ATOMIC_ACQUIRE));
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A decoded BGRA photo. */
+struct gphoto_still {
+    uint8_t *data;
+    size_t capacity;
+    uint32_t width;
+    uint32_t height;
+};
+
+/*
+ * Hands the newest photo from one producer to one consumer without a lock. A photo posted before
+ * the last one was taken replaces it. Buffers are recycled: the consumer releases what it took and
+ * the producer gets it back as its next buffer.
+ */
+struct gphoto_mailbox {
+    struct gphoto_still *full;
+    struct gphoto_still *spare;
+};
+
+/* Producer side. */
+struct gphoto_still *gphoto_mailbox_acquire(struct gphoto_mailbox *mailbox, uint32_t width, uint32_t height);
+void gphoto_mailbox_post(struct gphoto_mailbox *mailbox, struct gphoto_still *still);
+
+/* Consumer side, NULL if nothing new was posted. */
+struct gphoto_still *gphoto_mailbox_take(struct gphoto_mailbox *mailbox);
+void gphoto_mailbox_release(struct gphoto_mailbox *mailbox, struct gphoto_still *still);
+
+/* Neither side may run any more. */
+void gphoto_mailbox_free(struct gphoto_mailbox *mailbox);
@@ -0,0 +1,98 @@
+#include <obs-module.h>
+
+#include "gphoto-pacing.h"
+
+#define PACER_DEFAULT_FPS 30
+/* Exponential moving averages keep 1/8 of every new sample. */
+#define PACER_EWMA_SHIFT 3
+/* Polls aim 1/16 of a frame early and retry 1/8 of a frame after a repeat. */
+#define PACER_EARLY_SHIFT 4
+#define PACER_RETRY_SHIFT 3
+/* Smooth mode drifts towards the real capture time by 1/8 of the error per frame. */
+#define PACER_DRIFT_SHIFT 3
+
+static inline void ewma_update(uint64_t *avg, uint64_t sample) {
+    if (*avg == 0) {
+        *avg = sample;
+    } else {
+        *avg = *avg - (*avg >> PACER_EWMA_SHIFT) + (sample >> PACER_EWMA_SHIFT);
+    }
+}
+
+void preview_pacer_init(struct preview_pacer *pacer, enum preview_pacing mode, long long fps) {
+    memset(pacer, 0, sizeof(struct preview_pacer));
+    pacer->mode = mode;
+    preview_pacer_set_fps(pacer, fps);
+    pacer->delivery_interval = pacer->min_interval;
+}
+
+void preview_pacer_set_fps(struct preview_pacer *pacer, long long fps) {
+    if (fps <= 0) {
+        fps = PACER_DEFAULT_FPS;
+    }
+    pacer->min_interval = 1000000000ULL / (uint64_t)fps;
+}
+
+uint64_t preview_pacer_next_poll(struct preview_pacer *pacer) {
+    uint64_t next, expected;
+
+    if (!pacer->last_poll) {
+        return os_gettime_ns();
+    }
+
+    /* Got the old frame again, the new one is due any moment. */
+    if (pacer->stale) {
+        return pacer->last_poll + (pacer->delivery_interval >> PACER_RETRY_SHIFT);
+    }
+
+    /* Never poll faster than the fps limit... */
+    next = pacer->last_poll + pacer->min_interval;
+
+    /*
+     * ...and aim the request to arrive right when the camera has its next frame. Aiming slightly
+     * early keeps the estimate honest: a repeat costs one quick retry, lateness would go unnoticed.
+     */
+    expected = pacer->last_fresh + pacer->delivery_interval - (pacer->delivery_interval >> PACER_EARLY_SHIFT);
+    if (expected > pacer->fetch_duration / 2) {
+        expected -= pacer->fetch_duration / 2;
+    }
+    if (pacer->last_fresh && expected > next) {
+        next = expected;
+    }
+    return next;
+}
+
+uint64_t preview_pacer_frame(struct preview_pacer *pacer, uint64_t fetch_start, uint64_t fetch_end, bool fresh) {
+    /* The camera hands out its latest frame somewhere during the round trip, take the middle. */
+    uint64_t acquired = fetch_start + (fetch_end - fetch_start) / 2;
+    uint64_t expected, timestamp;
+
+    pacer->last_poll = fetch_start;
+    ewma_update(&pacer->fetch_duration, fetch_end - fetch_start);
+
+    pacer->stale = !fresh;
+    if (!fresh) {
+        return 0;
+    }
+
+    if (pacer->last_fresh) {
+        ewma_update(&pacer->delivery_interval, acquired - pacer->last_fresh);
+    }
+    pacer->last_fresh = acquired;
+
+    timestamp = acquired;
+    if (pacer->mode == PREVIEW_PACING_SMOOTH && pacer->last_timestamp) {
+        /* Evenly spaced timestamps, slowly pulled back to the real capture times. */
+        expected = pacer->last_timestamp + pacer->delivery_interval;
+        if (acquired > expected + 2 * pacer->delivery_interval || acquired + 2 * pacer->delivery_interval < expected) {
+            timestamp = acquired;
+        } else if (acquired >= expected) {
+            timestamp = expected + ((acquired - expected) >> PACER_DRIFT_SHIFT);
+        } else {
+            timestamp = expected - ((expected - acquired) >> PACER_DRIFT_SHIFT);
+        }
+    }
+    pacer->last_timestamp = timestamp;
+
+    return timestamp;
+}
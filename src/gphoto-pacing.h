@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum preview_pacing {
+    PREVIEW_PACING_LATENCY,
+    PREVIEW_PACING_SMOOTH,
+};
+
+/*
+ * Learns how often the camera really produces a new live view frame and how long a USB fetch
+ * takes, then schedules the next fetch to land just after the next frame is ready.
+ */
+struct preview_pacer {
+    enum preview_pacing mode;
+    uint64_t min_interval;
+
+    uint64_t delivery_interval;
+    uint64_t fetch_duration;
+    uint64_t last_poll;
+    uint64_t last_fresh;
+    uint64_t last_timestamp;
+    bool stale;
+};
+
+void preview_pacer_init(struct preview_pacer *pacer, enum preview_pacing mode, long long fps);
+void preview_pacer_set_fps(struct preview_pacer *pacer, long long fps);
+uint64_t preview_pacer_next_poll(struct preview_pacer *pacer);
+uint64_t preview_pacer_frame(struct preview_pacer *pacer, uint64_t fetch_start, uint64_t fetch_end, bool fresh);
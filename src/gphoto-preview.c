@@ -1,11 +1,8 @@
-#include <magick/MagickCore.h>
-
 #include "gphoto-preview.h"
 #include "gphoto-utils.h"
-#if HAVE_UDEV
-#include "gphoto-udev.h"
-#endif
-
+#include "gphoto-discovery.h"
+#include "gphoto-jpeg.h"
+#include "gphoto-sizes.h"
 
 
 static const char *capture_getname(void *vptr) {
@@ -15,6 +12,10 @@ static const char *capture_getname(void *vptr) {
 
 static void capture_defaults(obs_data_t *settings) {
     obs_data_set_default_int(settings, "fps", 30);
+    obs_data_set_default_int(settings, "format", VIDEO_FORMAT_BGRX);
+    obs_data_set_default_int(settings, "pacing", PREVIEW_PACING_LATENCY);
+    obs_data_set_default_int(settings, "scale", 1);
+    obs_data_set_default_int(settings, "decode_depth", 1);
 }
 
 static bool capture_camera_selected(obs_properties_t *props, obs_property_t *prop, obs_data_t *settings){
@@ -33,16 +34,82 @@ static bool capture_fps_selected(obs_properties_t *props, obs_property_t *prop,
     return true;
 }
 
+static bool capture_format_selected(obs_properties_t *props, obs_property_t *prop, obs_data_t *settings){
+    UNUSED_PARAMETER(props);
+    UNUSED_PARAMETER(prop);
+    obs_data_set_string(settings, "changed", "format");
+
+    return true;
+}
+
+static bool capture_pacing_selected(obs_properties_t *props, obs_property_t *prop, obs_data_t *settings){
+    UNUSED_PARAMETER(props);
+    UNUSED_PARAMETER(prop);
+    obs_data_set_string(settings, "changed", "pacing");
+
+    return true;
+}
+
+static bool capture_scale_selected(obs_properties_t *props, obs_property_t *prop, obs_data_t *settings){
+    UNUSED_PARAMETER(props);
+    UNUSED_PARAMETER(prop);
+    obs_data_set_string(settings, "changed", "scale");
+
+    return true;
+}
+
+static bool capture_decode_depth_changed(obs_properties_t *props, obs_property_t *prop, obs_data_t *settings){
+    UNUSED_PARAMETER(props);
+    UNUSED_PARAMETER(prop);
+    obs_data_set_string(settings, "changed", "decode_depth");
+
+    return true;
+}
+
+static bool capture_stats_refresh(obs_properties_t *props, obs_property_t *prop, void *vptr){
+    UNUSED_PARAMETER(props);
+    UNUSED_PARAMETER(prop);
+    struct preview_data *data = vptr;
+    obs_data_t *settings = obs_source_get_settings(data->source);
+
+    /* Decoding is shared with the other sources on the camera, so are the numbers. */
+    if (gphoto_connection_lock_streaming(&data->connection)) {
+        gphoto_stats_update_settings(&data->device->stats, settings);
+        gphoto_connection_unlock(&data->connection);
+    }
+    obs_data_release(settings);
+
+    return true;
+}
+
+/* The focus buttons are named after the step they drive. */
+static bool capture_manualfocus_clicked(obs_properties_t *props, obs_property_t *prop, void *vptr){
+    UNUSED_PARAMETER(props);
+    struct preview_data *data = vptr;
+    const char *value = obs_property_name(prop);
+
+    if (gphoto_connection_lock_streaming(&data->connection)) {
+        gphoto_device_set_manualfocus(data->device, value);
+        gphoto_connection_unlock(&data->connection);
+    }
+
+    return true;
+}
+
 static obs_properties_t *capture_properties(void *vptr){
     struct preview_data *data = vptr;
 
     obs_properties_t *props = obs_properties_create();
     obs_data_t *settings = obs_source_get_settings(data->source);
-    int cam_count = gp_list_count(data->cam_list);
+    CameraList *cameras = NULL;
+
+    gp_list_new(&cameras);
+    gphoto_discovery_list(cameras);
+    int cam_count = gp_list_count(cameras);
     if(cam_count > 0) {
         obs_property_t *cam_list = obs_properties_add_list(props, "camera_name", obs_module_text("Camera"),
                                                            OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
-        property_cam_list(data->cam_list, cam_list);
+        property_cam_list(cameras, cam_list);
         obs_property_set_modified_callback(cam_list, capture_camera_selected);
 
 
@@ -53,139 +120,173 @@ static obs_properties_t *capture_properties(void *vptr){
         obs_property_list_add_int(fps_list, "60", 60);
         obs_property_set_modified_callback(fps_list, capture_fps_selected);
 
-        if (data->camera) {
-            pthread_mutex_lock(&data->camera_mutex);
-            create_autofocus_property(props, settings, data->camera, data->gp_context);
-            create_manualfocus_property(props, settings, data->camera, data->gp_context);
+        obs_property_t *format_list = obs_properties_add_list(props, "format", obs_module_text("Output format"),
+                                                              OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+        obs_property_list_add_int(format_list, "BGRX", VIDEO_FORMAT_BGRX);
+        obs_property_list_add_int(format_list, "I420", VIDEO_FORMAT_I420);
+        obs_property_set_modified_callback(format_list, capture_format_selected);
+
+        obs_property_t *pacing_list = obs_properties_add_list(props, "pacing", obs_module_text("Frame pacing"),
+                                                              OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+        obs_property_list_add_int(pacing_list, obs_module_text("Lowest latency"), PREVIEW_PACING_LATENCY);
+        obs_property_list_add_int(pacing_list, obs_module_text("Smooth"), PREVIEW_PACING_SMOOTH);
+        obs_property_set_modified_callback(pacing_list, capture_pacing_selected);
+
+        obs_property_t *scale_list = obs_properties_add_list(props, "scale", obs_module_text("Preview scale"),
+                                                             OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+        obs_property_list_add_int(scale_list, "1", 1);
+        obs_property_list_add_int(scale_list, "1/2", 2);
+        obs_property_list_add_int(scale_list, "1/4", 4);
+        obs_property_list_add_int(scale_list, "1/8", 8);
+        obs_property_set_modified_callback(scale_list, capture_scale_selected);
+
+        obs_property_t *decode_depth = obs_properties_add_int(props, "decode_depth",
+                                                              obs_module_text("Frames decoded in parallel"),
+                                                              1, PREVIEW_MAX_DECODE_DEPTH, 1);
+        obs_property_set_modified_callback(decode_depth, capture_decode_depth_changed);
+
+        obs_property_t *status = obs_properties_add_text(props, "status", obs_module_text("Status"),
+                                                         OBS_TEXT_DEFAULT);
+        obs_property_set_enabled(status, false);
+        obs_data_set_string(settings, "status", obs_module_text(
+                gphoto_connection_state_name(gphoto_connection_state(&data->connection))));
+
+        if (gphoto_connection_lock_streaming(&data->connection)) {
+            struct gphoto_device *device = data->device;
+            CameraWidget *config;
+
+            config = gphoto_device_config_lock(device);
+            create_autofocus_property(props, settings, config);
+            create_manualfocus_property(props, settings, config, capture_manualfocus_clicked);
             create_obs_property_from_camera_config(props, settings, obs_module_text("Shutter Speed"),
-                                                   data->camera, data->gp_context, "shutterspeed");
-            create_obs_property_from_camera_config(props, settings, obs_module_text("Aperture"),
-                                                   data->camera, data->gp_context, "aperture");
-            create_obs_property_from_camera_config(props, settings, obs_module_text("ISO"),
-                                                   data->camera, data->gp_context, "iso");
+                                                   config, "shutterspeed");
+            create_obs_property_from_camera_config(props, settings, obs_module_text("Aperture"), config, "aperture");
+            create_obs_property_from_camera_config(props, settings, obs_module_text("ISO"), config, "iso");
             create_obs_property_from_camera_config(props, settings, obs_module_text("White balance"),
-                                                   data->camera, data->gp_context, "whitebalance");
+                                                   config, "whitebalance");
             create_obs_property_from_camera_config(props, settings, obs_module_text("Picture style"),
-                                                   data->camera, data->gp_context, "picturestyle");
-            pthread_mutex_unlock(&data->camera_mutex);
+                                                   config, "picturestyle");
+            gphoto_device_config_unlock(device);
+            create_stats_property(props, settings, &device->stats, capture_stats_refresh);
+            gphoto_connection_unlock(&data->connection);
         }
     }
 
+    gp_list_free(cameras);
     obs_data_release(settings);
 
     return props;
 }
 
-static void *capture_thread(void *vptr){
+static void capture_output(void *vptr, struct obs_source_frame *frame){
     struct preview_data *data = vptr;
-    uint8_t *texture_data = malloc(data->width * data->height * 4);
-    uint64_t cur_time = os_gettime_ns();
-
-    struct obs_source_frame frame = {
-            .data     = {[0] = texture_data},
-            .linesize = {[0] = data->width*4},
-            .width    = data->width,
-            .height   = data->height,
-            .format   = VIDEO_FORMAT_BGRX
-    };
-
-    while (os_event_try(data->event) == EAGAIN){
-        frame.timestamp = cur_time;
-        pthread_mutex_lock(&data->camera_mutex);
-        gphoto_capture_preview(data->camera, data->gp_context, data->width, data->height, texture_data);
-        pthread_mutex_unlock(&data->camera_mutex);
-        obs_source_output_video(data->source, &frame);
-        switch (data->fps){
-            case 60:
-                os_sleepto_ns(cur_time += 15000000);
-                break;
-            case 30:
-                os_sleepto_ns(cur_time += 30000000);
-                break;
-            case 25:
-                os_sleepto_ns(cur_time += 40000000);
-                break;
-            default:
-                os_sleepto_ns(cur_time += 50000000);
-                break;
-        }
-    }
+    obs_source_output_video(data->source, frame);
+}
 
-    free(texture_data);
+/* Grey frame at the last known size, shown while the camera connects. */
+static void capture_output_placeholder(struct preview_data *data){
+    struct obs_source_frame frame = {0};
 
-    return NULL;
+    if (!data->width || !data->height) {
+        return;
+    }
+    frame.width = data->width;
+    frame.height = data->height;
+    frame.format = VIDEO_FORMAT_BGRX;
+    frame.linesize[0] = data->width * 4;
+    frame.data[0] = bmalloc(frame.linesize[0] * data->height);
+    memset(frame.data[0], 0x20, frame.linesize[0] * data->height);
+    frame.timestamp = os_gettime_ns();
+    obs_source_output_video(data->source, &frame);
+    bfree(frame.data[0]);
 }
 
-static void capture_init(void *vptr){
-    struct preview_data *data = vptr;
-    CameraFile *cam_file = NULL;
-    const char *image_data = NULL;
-    unsigned long data_size = NULL;
-    Image *image = NULL;
-    ImageInfo *image_info = AcquireImageInfo();
-    ExceptionInfo *exception = AcquireExceptionInfo();
-
-    if (gp_file_new(&cam_file) < GP_OK) {
-            blog(LOG_WARNING, "What???\n");
-        } else {
-        if (gp_camera_by_name(&data->camera, data->camera_name, data->cam_list, data->gp_context) < GP_OK) {
-            blog(LOG_WARNING, "Can't get camera.\n");
-        } else {
-            if (gp_camera_init(data->camera, data->gp_context) < GP_OK) {
-                blog(LOG_WARNING, "Can't init camera.\n");
-            } else {
-                if (gp_camera_capture_preview(data->camera, cam_file, data->gp_context) < GP_OK) {
-                    blog(LOG_WARNING, "Can't capture preview.\n");
-                } else {
-                    if (gp_file_get_data_and_size(cam_file, &image_data, &data_size) < GP_OK) {
-                        blog(LOG_WARNING, "Can't get image data.\n");
-                    } else {
-                        image = BlobToImage(image_info, image_data, data_size, exception);
-                        if (exception->severity != UndefinedException) {
-                            CatchException(exception);
-                            blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *)exception->severity);
-                            exception->severity = UndefinedException;
-                        } else {
-                            data->width = (uint32_t)image->magick_columns;
-                            data->height = (uint32_t)image->magick_rows;
-
-                            os_event_init(&data->event, OS_EVENT_TYPE_MANUAL);
-                            pthread_create(&data->thread, NULL, capture_thread, data);
-                        }
-                    }
-                }
-            }
-        }
+/*
+ * Connection worker: copies the settings that shape the stream into the viewer, the device reads them when it is
+ * watched. update writes them on the UI thread, one snapshot keeps format, scale and depth consistent.
+ */
+static void capture_set_viewer(struct preview_data *data){
+    long long int depth;
+
+    gphoto_connection_lock(&data->connection);
+    depth = data->decode_depth;
+    data->viewer.format = data->format;
+    data->viewer.scale = data->scale;
+    data->viewer.fps = data->fps;
+    data->viewer.pacing = data->pacing;
+    gphoto_connection_unlock(&data->connection);
+
+    if (depth < 1 || depth > PREVIEW_MAX_DECODE_DEPTH) {
+        depth = 1;
     }
+    data->viewer.output = capture_output;
+    data->viewer.param = data;
+    data->viewer.depth = (size_t)depth;
+}
 
-    if(image_data){
-        free(image_data);
+static bool capture_watch(struct preview_data *data){
+    if (!gphoto_device_watch(data->device, &data->viewer)) {
+        return false;
     }
-    if(image_info){
-        DestroyImageInfo(image_info);
+    data->width = data->viewer.width;
+    data->height = data->viewer.height;
+    return true;
+}
+
+/* Connection worker: other sources may have the camera open already, then only the live view is shared. */
+static bool capture_connect(void *vptr){
+    struct preview_data *data = vptr;
+    struct gphoto_frame_size size;
+    char *camera_name = gphoto_connection_get_string(&data->connection, &data->camera_name);
+    bool autofocus, connected = false;
+
+    capture_set_viewer(data);
+    /* Before the first stream of this source the size comes from an earlier run with the same camera. */
+    if (!data->width && gphoto_sizes_get(camera_name, GPHOTO_SIZES_LIVE_VIEW, &size)) {
+        data->width = gphoto_jpeg_scaled(size.width, size.jpeg ? data->viewer.scale : 1);
+        data->height = gphoto_jpeg_scaled(size.height, size.jpeg ? data->viewer.scale : 1);
     }
-    if(image){
-        DestroyImageList(image);
+    capture_output_placeholder(data);
+
+    /* Without udev a camera plugged in later is only found by another scan. */
+    if (!gphoto_discovery_has(camera_name)) {
+        gphoto_discovery_refresh();
     }
-    if(exception){
-        DestroyExceptionInfo(exception);
+
+    data->device = gphoto_device_open(camera_name);
+    if (data->device && capture_watch(data)) {
+        gphoto_connection_lock(&data->connection);
+        autofocus = data->autofocus;
+        gphoto_connection_unlock(&data->connection);
+        if (autofocus) {
+            gphoto_device_set_autofocus(data->device, true);
+        }
+        connected = true;
     }
+    obs_source_update_properties(data->source);
+    bfree(camera_name);
+
+    return connected;
 }
 
-static void capture_terminate(void *vptr){
+/* Connection worker, nothing else touches the device once the connection left the streaming state. */
+static void capture_disconnect(void *vptr){
     struct preview_data *data = vptr;
 
-    if(data->event) {
-        os_event_signal(data->event);
-        if(data->thread != 0){
-            pthread_join(data->thread, NULL);
-        }
-        os_event_destroy(data->event);
+    if (data->device) {
+        gphoto_device_unwatch(data->device, &data->viewer);
+        gphoto_device_close(data->device);
+        data->device = NULL;
     }
+}
+
+/* Connection worker: moves this source to the decode of its new settings, the other viewers keep theirs. */
+static bool capture_refresh(void *vptr){
+    struct preview_data *data = vptr;
 
-    gp_camera_exit(data->camera, data->gp_context);
-    gp_camera_free(data->camera);
-    data->camera = NULL;
+    gphoto_device_unwatch(data->device, &data->viewer);
+    capture_set_viewer(data);
+    return capture_watch(data);
 }
 
 static void capture_update(void *vptr, obs_data_t *settings){
@@ -194,145 +295,121 @@ static void capture_update(void *vptr, obs_data_t *settings){
     const char *changed = obs_data_get_string(settings, "changed");
 
     if (strcmp(changed, "camera") == 0) {
-        data->camera_name = obs_data_get_string(settings, "camera_name");
-        if (data->source->active) {
-            capture_terminate(data);
-            pthread_mutex_lock(&data->camera_mutex);
-            capture_init(data);
-            pthread_mutex_unlock(&data->camera_mutex);
-            obs_source_update_properties(data->source);
-            if(data->autofocus) {
-                pthread_mutex_lock(&data->camera_mutex);
-                set_autofocus(data->camera, data->gp_context);
-                pthread_mutex_unlock(&data->camera_mutex);
-            }
+        gphoto_connection_set_string(&data->connection, &data->camera_name,
+                                     obs_data_get_string(settings, "camera_name"));
+        if (strcmp(data->camera_name, "") == 0) {
+            gphoto_connection_close(&data->connection);
+        } else if (obs_source_showing(data->source)) {
+            gphoto_connection_open(&data->connection);
+            gphoto_connection_restart(&data->connection);
+        }
+    }
+
+    if(strcmp(changed, "fps") == 0 || strcmp(changed, "pacing") == 0){
+        long long int fps = obs_data_get_int(settings, "fps");
+        enum preview_pacing pacing = (enum preview_pacing)obs_data_get_int(settings, "pacing");
+
+        gphoto_connection_lock(&data->connection);
+        data->fps = fps;
+        data->pacing = pacing;
+        gphoto_connection_unlock(&data->connection);
+        obs_source_set_async_unbuffered(data->source, pacing == PREVIEW_PACING_LATENCY);
+        if (gphoto_connection_lock_streaming(&data->connection)) {
+            gphoto_device_set_pacing(data->device, &data->viewer, fps, pacing);
+            gphoto_connection_unlock(&data->connection);
         }
     }
 
-    if(strcmp(changed, "fps") == 0){
-        data->fps = obs_data_get_int(settings, "fps");
+    if(strcmp(changed, "format") == 0 || strcmp(changed, "scale") == 0 || strcmp(changed, "decode_depth") == 0){
+        gphoto_connection_lock(&data->connection);
+        data->format = (enum video_format)obs_data_get_int(settings, "format");
+        data->scale = (uint32_t)obs_data_get_int(settings, "scale");
+        data->decode_depth = obs_data_get_int(settings, "decode_depth");
+        gphoto_connection_unlock(&data->connection);
+        /* Unwatching joins the fetch thread and watching may probe the camera, the worker does both. */
+        gphoto_connection_refresh(&data->connection);
     }
 
     if (strcmp(changed, "autofocus") == 0) {
-        data->autofocus = obs_data_get_bool(settings, "autofocusdrive");
-        if(data->autofocus) {
-            pthread_mutex_lock(&data->camera_mutex);
-            set_autofocus(data->camera, data->gp_context);
-            pthread_mutex_unlock(&data->camera_mutex);
-        }else{
-            pthread_mutex_lock(&data->camera_mutex);
-            cancel_autofocus(data->camera, data->gp_context);
-            pthread_mutex_unlock(&data->camera_mutex);
+        bool autofocus = obs_data_get_bool(settings, "autofocusdrive");
+
+        gphoto_connection_lock(&data->connection);
+        data->autofocus = autofocus;
+        gphoto_connection_unlock(&data->connection);
+        if (gphoto_connection_lock_streaming(&data->connection)) {
+            gphoto_device_set_autofocus(data->device, autofocus);
+            gphoto_connection_unlock(&data->connection);
         }
     }
 
     if (strcmp(changed, "manualfocus") == 0) {
         const char *manual_focus = obs_data_get_string(settings, "manualfocus");
-        pthread_mutex_lock(&data->camera_mutex);
-        set_manualfocus(manual_focus, data->camera, data->gp_context);
-        pthread_mutex_unlock(&data->camera_mutex);
+        if (gphoto_connection_lock_streaming(&data->connection)) {
+            gphoto_device_set_manualfocus(data->device, manual_focus);
+            gphoto_connection_unlock(&data->connection);
+        }
     }
 
     if (strcmp(changed, "auto_prop") == 0) {
-        pthread_mutex_lock(&data->camera_mutex);
-        set_camera_config(settings, data->camera, data->gp_context);
-        pthread_mutex_unlock(&data->camera_mutex);
+        if (gphoto_connection_lock_streaming(&data->connection)) {
+            gphoto_device_set_config(data->device, settings, obs_data_get_string(settings, "auto_prop"));
+            gphoto_connection_unlock(&data->connection);
+        }
     }
 }
 
-#if HAVE_UDEV
 static void capture_camera_added(void *vptr, calldata_t *calldata) {
-    UNUSED_PARAMETER(calldata);
     struct preview_data *data = vptr;
-    int i, count;
-    const char *camera_name;
-    if(!data->camera){
-        pthread_mutex_lock(&data->camera_mutex);
-        gphoto_cam_list(data->cam_list, data->gp_context);
-        count = gp_list_count(data->cam_list);
-        for(i=0; i<count; i++){
-            gp_list_get_name(data->cam_list, i, &camera_name);
-            if (strcmp(camera_name, data->camera_name) == 0) {
-                capture_init(data);
-                obs_source_update_properties(data->source);
-                if(data->autofocus) {
-                    set_autofocus(data->camera, data->gp_context);
-                }
-            }
-        }
-        pthread_mutex_unlock(&data->camera_mutex);
+
+    if (gphoto_connection_string_is(&data->connection, &data->camera_name, calldata_string(calldata, "model"))) {
+        gphoto_connection_retry(&data->connection);
     }
+    obs_source_update_properties(data->source);
 }
 
 static void capture_camera_removed(void *vptr, calldata_t *calldata) {
-    UNUSED_PARAMETER(calldata);
     struct preview_data *data = vptr;
-    int i, count;
-    const char *camera_name;
-    if(data->camera){
-        pthread_mutex_lock(&data->camera_mutex);
-        gphoto_cam_list(data->cam_list, data->gp_context);
-        pthread_mutex_unlock(&data->camera_mutex);
-        count = gp_list_count(data->cam_list);
-        for(i=0; i<count; i++){
-            gp_list_get_name(data->cam_list, i, &camera_name);
-            if (strcmp(camera_name, data->camera_name) == 0) {
-                return;
-            }
-        }
-        capture_terminate(data);
-        obs_source_update_properties(data->source);
+
+    if (gphoto_connection_string_is(&data->connection, &data->camera_name, calldata_string(calldata, "model")) &&
+        gphoto_connection_state(&data->connection) == GPHOTO_CONNECTION_STREAMING) {
+        /* Retries until the camera is back or the attempts run out, camera_added wakes it up again. */
+        gphoto_connection_restart(&data->connection);
     }
+    obs_source_update_properties(data->source);
 }
-#endif
 
 static void capture_show(void *vptr) {
     struct preview_data *data = vptr;
-    if (strcmp(data->camera_name, "") != 0) {
-        if (!data->source->active && !data->camera) {
-            capture_terminate(data);
-            pthread_mutex_lock(&data->camera_mutex);
-            capture_init(data);
-            pthread_mutex_unlock(&data->camera_mutex);
-            obs_source_update_properties(data->source);
-            if(data->autofocus) {
-                pthread_mutex_lock(&data->camera_mutex);
-                set_autofocus(data->camera, data->gp_context);
-                pthread_mutex_unlock(&data->camera_mutex);
-            }
-        }
+    /* Runs on the video thread. */
+    if (!gphoto_connection_string_is(&data->connection, &data->camera_name, "")) {
+        gphoto_connection_open(&data->connection);
     }
 }
 
 static void capture_hide(void *vptr) {
     struct preview_data *data = vptr;
-    if(data->source->active) {
-        capture_terminate(data);
-    }
+    gphoto_connection_close(&data->connection);
 }
 
 static void *capture_create(obs_data_t *settings, obs_source_t *source){
     struct preview_data *data = bzalloc(sizeof(struct preview_data));
 
-    pthread_mutex_init(&data->camera_mutex, NULL);
-
     data->source = source;
-    data->gp_context = gp_context_new();
 
-    gp_list_new(&data->cam_list);
-    gphoto_cam_list(data->cam_list, data->gp_context);
-
-    data->camera_name = obs_data_get_string(settings, "camera_name");
+    data->camera_name = bstrdup(obs_data_get_string(settings, "camera_name"));
     data->fps = obs_data_get_int(settings, "fps");
+    data->format = (enum video_format)obs_data_get_int(settings, "format");
+    data->pacing = (enum preview_pacing)obs_data_get_int(settings, "pacing");
+    data->scale = (uint32_t)obs_data_get_int(settings, "scale");
+    data->decode_depth = obs_data_get_int(settings, "decode_depth");
+    obs_source_set_async_unbuffered(source, data->pacing == PREVIEW_PACING_LATENCY);
     data->autofocus = obs_data_get_bool(settings, "autofocusdrive");
 
-    #if HAVE_UDEV
-    gphoto_init_udev();
-    signal_handler_t *sh = gphoto_get_udev_signalhandler();
+    gphoto_connection_init(&data->connection, source, capture_connect, capture_disconnect, capture_refresh, data);
 
-    signal_handler_connect(sh, "device_added", &capture_camera_added, data);
-    signal_handler_connect(sh, "device_removed", &capture_camera_removed, data);
-    #endif
+    signal_handler_t *sh = gphoto_discovery_signalhandler();
+    signal_handler_connect(sh, "camera_added", capture_camera_added, data);
+    signal_handler_connect(sh, "camera_removed", capture_camera_removed, data);
 
     return data;
 }
@@ -340,21 +417,13 @@ static void *capture_create(obs_data_t *settings, obs_source_t *source){
 static void capture_destroy(void *vptr) {
     struct preview_data *data = vptr;
 
-    if(data->source->active){
-        capture_terminate(data);
-    }
-
-    pthread_mutex_destroy(&data->camera_mutex);
-    gp_context_unref(data->gp_context);
-    gp_list_free(data->cam_list);
-
-    signal_handler_t *sh = gphoto_get_udev_signalhandler();
-
-    signal_handler_disconnect(sh, "device_added", capture_camera_added, data);
-    signal_handler_disconnect(sh, "device_removed", capture_camera_removed, data);
+    signal_handler_t *sh = gphoto_discovery_signalhandler();
+    signal_handler_disconnect(sh, "camera_added", capture_camera_added, data);
+    signal_handler_disconnect(sh, "camera_removed", capture_camera_removed, data);
 
-    gphoto_unref_udev();
+    gphoto_connection_free(&data->connection);
 
+    bfree(data->camera_name);
     bfree(vptr);
 }
 
@@ -371,7 +440,7 @@ static uint32_t capture_getheight(void *vptr) {
 struct obs_source_info capture_preview_info = {
     .id             = "gphoto-capture-preview",
     .type           = OBS_SOURCE_TYPE_INPUT,
-    .output_flags   = OBS_SOURCE_ASYNC_VIDEO | OBS_SOURCE_DO_NOT_DUPLICATE,
+    .output_flags   = OBS_SOURCE_ASYNC_VIDEO,
 
     .get_name       = capture_getname,
     .get_defaults   = capture_defaults,
@@ -1,24 +1,31 @@
+#pragma once
+
 #include <obs-module.h>
 #include <obs-internal.h>
 #include <gphoto2/gphoto2-camera.h>
 
+#include "gphoto-connection.h"
+#include "gphoto-device.h"
+#include "gphoto-pacing.h"
+
+#define PREVIEW_MAX_DECODE_DEPTH 4
+
 struct preview_data {
-    /* settings */
-    const char *camera_name;
+    /* settings, written under the connection's mutex, the worker reads them */
+    char *camera_name;
     long long int fps;
+    enum video_format format;
+    enum preview_pacing pacing;
+    uint32_t scale;
+    long long int decode_depth;
     bool autofocus;
 
     /* internal data */
     obs_source_t *source;
-    pthread_t thread;
-    os_event_t *event;
-    pthread_mutex_t camera_mutex;
+    struct gphoto_connection connection;
+    struct gphoto_device *device;
+    struct gphoto_viewer viewer;
 
     uint32_t width;
     uint32_t height;
-
-
-    CameraList *cam_list;
-    Camera *camera;
-    GPContext *gp_context;
 };
\ No newline at end of file
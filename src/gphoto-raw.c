@@ -0,0 +1,210 @@
+#include <obs-module.h>
+
+#include "gphoto-raw.h"
+
+#define RAW_MAX_IFDS 32
+/* Thumbnails are too small to show, a TIFF with only those is left to ImageMagick. */
+#define RAW_MIN_PREVIEW_WIDTH 640
+
+#define TIFF_TAG_COMPRESSION 0x0103
+#define TIFF_TAG_STRIP_OFFSETS 0x0111
+#define TIFF_TAG_STRIP_BYTE_COUNTS 0x0117
+#define TIFF_TAG_SUB_IFDS 0x014A
+#define TIFF_TAG_JPEG_OFFSET 0x0201
+#define TIFF_TAG_JPEG_LENGTH 0x0202
+
+#define TIFF_TYPE_SHORT 3
+#define TIFF_COMPRESSION_OLD_JPEG 6
+#define TIFF_COMPRESSION_JPEG 7
+
+struct raw_reader {
+    const uint8_t *data;
+    size_t size;
+    bool big_endian;
+
+    /* Every IFD found so far, visited in order. Offsets seen twice are skipped, so loops end. */
+    uint32_t ifds[RAW_MAX_IFDS];
+    size_t ifd_count;
+
+    const uint8_t *best;
+    size_t best_size;
+    uint64_t best_area;
+};
+
+/* Callers check the bounds. */
+static uint16_t raw_u16(const struct raw_reader *reader, size_t offset) {
+    const uint8_t *p = reader->data + offset;
+
+    return reader->big_endian ? (uint16_t)(p[0] << 8 | p[1]) : (uint16_t)(p[1] << 8 | p[0]);
+}
+
+static uint32_t raw_u32(const struct raw_reader *reader, size_t offset) {
+    const uint8_t *p = reader->data + offset;
+
+    if (reader->big_endian) {
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+/* The value of an entry with a count of one, a SHORT sits in the first two bytes of the field. */
+static uint32_t raw_entry_value(const struct raw_reader *reader, size_t entry) {
+    return raw_u16(reader, entry + 2) == TIFF_TYPE_SHORT ? raw_u16(reader, entry + 8) : raw_u32(reader, entry + 8);
+}
+
+static void raw_queue_ifd(struct raw_reader *reader, uint32_t offset) {
+    size_t i;
+
+    if (!offset || offset >= reader->size || reader->ifd_count == RAW_MAX_IFDS) {
+        return;
+    }
+    for (i = 0; i < reader->ifd_count; i++) {
+        if (reader->ifds[i] == offset) {
+            return;
+        }
+    }
+    reader->ifds[reader->ifd_count++] = offset;
+}
+
+/*
+ * Frame size from the SOF marker. The lossless JPEG that CR2 and some DNG store the sensor data in
+ * is refused here, it is not a picture.
+ */
+static bool raw_jpeg_size(const uint8_t *data, size_t size, uint32_t *width, uint32_t *height) {
+    size_t pos = 2;
+    uint8_t marker;
+
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) {
+            return false;
+        }
+        marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2) {
+            if (pos + 9 > size) {
+                return false;
+            }
+            *height = (uint32_t)(data[pos + 5] << 8 | data[pos + 6]);
+            *width = (uint32_t)(data[pos + 7] << 8 | data[pos + 8]);
+            return *width && *height;
+        }
+        if ((marker >= 0xC3 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) ||
+            marker == 0xDA || marker == 0xD9) {
+            return false;
+        }
+        pos += 2 + (size_t)(data[pos + 2] << 8 | data[pos + 3]);
+    }
+    return false;
+}
+
+static void raw_consider(struct raw_reader *reader, uint32_t offset, uint32_t length) {
+    uint32_t width, height;
+
+    if (!length || offset >= reader->size || length > reader->size - offset) {
+        return;
+    }
+    if (raw_jpeg_size(reader->data + offset, length, &width, &height) && width >= RAW_MIN_PREVIEW_WIDTH &&
+        (uint64_t)width * height > reader->best_area) {
+        reader->best = reader->data + offset;
+        reader->best_size = length;
+        reader->best_area = (uint64_t)width * height;
+    }
+}
+
+static void raw_queue_sub_ifds(struct raw_reader *reader, size_t entry) {
+    uint32_t count = raw_u32(reader, entry + 4);
+    uint32_t pointer, i;
+
+    if (count == 1) {
+        raw_queue_ifd(reader, raw_u32(reader, entry + 8));
+        return;
+    }
+    pointer = raw_u32(reader, entry + 8);
+    for (i = 0; i < count && pointer < reader->size && (size_t)i * 4 + 4 <= reader->size - pointer; i++) {
+        raw_queue_ifd(reader, raw_u32(reader, pointer + (size_t)i * 4));
+    }
+}
+
+/* A preview is either a JPEG interchange pair or, in CR2 IFD0 and DNG, a single JPEG compressed strip. */
+static void raw_read_ifd(struct raw_reader *reader, uint32_t offset) {
+    uint32_t compression = 0, strip_offset = 0, strip_length = 0, jpeg_offset = 0, jpeg_length = 0;
+    size_t entries, entry;
+    uint16_t count, i;
+
+    if (offset > reader->size - 2) {
+        return;
+    }
+    count = raw_u16(reader, offset);
+    entries = (size_t)offset + 2;
+    if (entries + (size_t)count * 12 + 4 > reader->size) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        entry = entries + (size_t)i * 12;
+        switch (raw_u16(reader, entry)) {
+            case TIFF_TAG_COMPRESSION:
+                compression = raw_entry_value(reader, entry);
+                break;
+            case TIFF_TAG_STRIP_OFFSETS:
+                strip_offset = raw_u32(reader, entry + 4) == 1 ? raw_entry_value(reader, entry) : 0;
+                break;
+            case TIFF_TAG_STRIP_BYTE_COUNTS:
+                strip_length = raw_u32(reader, entry + 4) == 1 ? raw_entry_value(reader, entry) : 0;
+                break;
+            case TIFF_TAG_JPEG_OFFSET:
+                jpeg_offset = raw_entry_value(reader, entry);
+                break;
+            case TIFF_TAG_JPEG_LENGTH:
+                jpeg_length = raw_entry_value(reader, entry);
+                break;
+            case TIFF_TAG_SUB_IFDS:
+                raw_queue_sub_ifds(reader, entry);
+                break;
+            default:
+                break;
+        }
+    }
+
+    raw_consider(reader, jpeg_offset, jpeg_length);
+    if (compression == TIFF_COMPRESSION_OLD_JPEG || compression == TIFF_COMPRESSION_JPEG) {
+        raw_consider(reader, strip_offset, strip_length);
+    }
+    raw_queue_ifd(reader, raw_u32(reader, entries + (size_t)count * 12));
+}
+
+bool gphoto_raw_preview(const uint8_t *data, size_t size, const uint8_t **preview, size_t *preview_size) {
+    struct raw_reader reader = {.data = data, .size = size};
+    size_t i;
+
+    if (!data || size < 8) {
+        return false;
+    }
+    if (data[0] == 'I' && data[1] == 'I') {
+        reader.big_endian = false;
+    } else if (data[0] == 'M' && data[1] == 'M') {
+        reader.big_endian = true;
+    } else {
+        return false;
+    }
+    if (raw_u16(&reader, 2) != 42) {
+        return false;
+    }
+
+    raw_queue_ifd(&reader, raw_u32(&reader, 4));
+    for (i = 0; i < reader.ifd_count; i++) {
+        raw_read_ifd(&reader, reader.ifds[i]);
+    }
+    if (!reader.best) {
+        return false;
+    }
+    *preview = reader.best;
+    *preview_size = reader.best_size;
+    return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Finds the largest baseline or progressive JPEG preview embedded in a TIFF based RAW file (CR2,
+ * NEF, DNG, ARW, PEF). preview points into data, nothing is copied or decoded.
+ */
+bool gphoto_raw_preview(const uint8_t *data, size_t size, const uint8_t **preview, size_t *preview_size);
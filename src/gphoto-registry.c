@@ -0,0 +1,336 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "gphoto-registry.h"
+#include "gphoto-trace.h"
+
+/* Open addressing with linear probing, kept at most half full. Keys are compared case-insensitively
+ * like gp_abilities_list_lookup_model does. */
+struct registry_entry {
+    char *key;
+    int index;
+};
+
+struct registry_map {
+    struct registry_entry *entries;
+    size_t capacity;
+    size_t count;
+};
+
+enum registry_state {
+    REGISTRY_EMPTY,
+    REGISTRY_LOADING,
+    REGISTRY_LOADED,
+};
+
+/*
+ * A bus scan reads the libgphoto2 lists for hundreds of ms, it holds lists_lock for reading instead of
+ * registry_mutex so lookups don't queue behind it. Only appending a port or freeing the lists takes it
+ * for writing, always before registry_mutex.
+ */
+static pthread_rwlock_t lists_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t registry_cond = PTHREAD_COND_INITIALIZER;
+static enum registry_state registry_state = REGISTRY_EMPTY;
+static CameraAbilitiesList *abilities_list = NULL;
+static GPPortInfoList *port_list = NULL;
+static struct registry_map models = {0};
+static struct registry_map ports = {0};
+static struct registry_map usb_ids = {0};
+
+static pthread_t warm_thread;
+static bool warm_started = false;
+
+static uint64_t registry_hash(const char *key) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (; *key; key++) {
+        hash = (hash ^ (uint8_t)tolower((unsigned char)*key)) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int map_find(struct registry_map *map, const char *key) {
+    size_t i;
+
+    if (!map->capacity) {
+        return -1;
+    }
+    for (i = registry_hash(key) & (map->capacity - 1); map->entries[i].key; i = (i + 1) & (map->capacity - 1)) {
+        if (strcasecmp(map->entries[i].key, key) == 0) {
+            return map->entries[i].index;
+        }
+    }
+    return -1;
+}
+
+static void map_insert_entry(struct registry_map *map, char *key, int index) {
+    size_t i;
+
+    for (i = registry_hash(key) & (map->capacity - 1); map->entries[i].key; i = (i + 1) & (map->capacity - 1)) {
+        if (strcasecmp(map->entries[i].key, key) == 0) {
+            /* The first driver for a model wins, like the linear lookup in libgphoto2. */
+            bfree(key);
+            return;
+        }
+    }
+    map->entries[i].key = key;
+    map->entries[i].index = index;
+    map->count++;
+}
+
+static void map_insert(struct registry_map *map, const char *key, int index) {
+    struct registry_entry *old = map->entries;
+    size_t i, old_capacity = map->capacity;
+
+    if ((map->count + 1) * 2 > map->capacity) {
+        map->capacity = old_capacity ? old_capacity * 2 : 256;
+        map->entries = bzalloc(map->capacity * sizeof(struct registry_entry));
+        map->count = 0;
+        for (i = 0; i < old_capacity; i++) {
+            if (old[i].key) {
+                map_insert_entry(map, old[i].key, old[i].index);
+            }
+        }
+        bfree(old);
+    }
+    map_insert_entry(map, bstrdup(key), index);
+}
+
+static void map_free(struct registry_map *map) {
+    size_t i;
+
+    for (i = 0; i < map->capacity; i++) {
+        bfree(map->entries[i].key);
+    }
+    bfree(map->entries);
+    memset(map, 0, sizeof(struct registry_map));
+}
+
+static void registry_usb_key(char *key, size_t size, int vendor, int product) {
+    snprintf(key, size, "%04x:%04x", vendor & 0xffff, product & 0xffff);
+}
+
+static void registry_add_port(int index) {
+    GPPortInfo info;
+    char *path;
+
+    if (gp_port_info_list_get_info(port_list, index, &info) == GP_OK &&
+        gp_port_info_get_path(info, &path) == GP_OK) {
+        map_insert(&ports, path, index);
+    }
+}
+
+/* Only the thread that moved the state to loading gets here, it returns with the lock held. */
+static void registry_load(void) {
+    CameraAbilitiesList *new_abilities = NULL;
+    GPPortInfoList *new_ports = NULL;
+    CameraAbilities abilities;
+    char usb_key[16];
+    uint64_t start = os_gettime_ns();
+    int i, count;
+    bool loaded = false;
+
+    if (gp_abilities_list_new(&new_abilities) < GP_OK || gp_abilities_list_load(new_abilities, NULL) < GP_OK) {
+        blog(LOG_WARNING, "Can't load camera drivers.\n");
+    } else if (gp_port_info_list_new(&new_ports) < GP_OK || gp_port_info_list_load(new_ports) < GP_OK) {
+        blog(LOG_WARNING, "Can't load port drivers.\n");
+    } else {
+        loaded = true;
+    }
+
+    pthread_mutex_lock(&registry_mutex);
+    if (loaded) {
+        abilities_list = new_abilities;
+        port_list = new_ports;
+        count = gp_abilities_list_count(abilities_list);
+        for (i = 0; i < count; i++) {
+            if (gp_abilities_list_get_abilities(abilities_list, i, &abilities) == GP_OK) {
+                map_insert(&models, abilities.model, i);
+                if (abilities.usb_vendor && abilities.usb_product) {
+                    registry_usb_key(usb_key, sizeof(usb_key), abilities.usb_vendor, abilities.usb_product);
+                    map_insert(&usb_ids, usb_key, i);
+                }
+            }
+        }
+        count = gp_port_info_list_count(port_list);
+        for (i = 0; i < count; i++) {
+            registry_add_port(i);
+        }
+        registry_state = REGISTRY_LOADED;
+        blog(LOG_INFO, "Loaded %zu camera models and %zu ports in %.1f ms.\n", models.count, ports.count,
+             (double)(os_gettime_ns() - start) / 1000000.0);
+    } else {
+        if (new_abilities) {
+            gp_abilities_list_free(new_abilities);
+        }
+        if (new_ports) {
+            gp_port_info_list_free(new_ports);
+        }
+        /* The next user tries again. */
+        registry_state = REGISTRY_EMPTY;
+    }
+    pthread_cond_broadcast(&registry_cond);
+    gphoto_trace_span("load drivers", start, os_gettime_ns());
+}
+
+/* Returns with the lock held, true if the drivers are loaded. */
+static bool registry_lock(void) {
+    pthread_mutex_lock(&registry_mutex);
+    if (registry_state == REGISTRY_EMPTY) {
+        registry_state = REGISTRY_LOADING;
+        pthread_mutex_unlock(&registry_mutex);
+        registry_load();
+    } else {
+        while (registry_state == REGISTRY_LOADING) {
+            pthread_cond_wait(&registry_cond, &registry_mutex);
+        }
+    }
+    return registry_state == REGISTRY_LOADED;
+}
+
+static void *warm_thread_main(void *vptr) {
+    UNUSED_PARAMETER(vptr);
+
+    gphoto_trace_thread_name("driver registry");
+    registry_lock();
+    pthread_mutex_unlock(&registry_mutex);
+    return NULL;
+}
+
+void gphoto_registry_warm(void) {
+    warm_started = pthread_create(&warm_thread, NULL, warm_thread_main, NULL) == 0;
+}
+
+void gphoto_registry_free(void) {
+    if (warm_started) {
+        pthread_join(warm_thread, NULL);
+        warm_started = false;
+    }
+
+    pthread_rwlock_wrlock(&lists_lock);
+    pthread_mutex_lock(&registry_mutex);
+    map_free(&models);
+    map_free(&ports);
+    map_free(&usb_ids);
+    if (abilities_list) {
+        gp_abilities_list_free(abilities_list);
+        abilities_list = NULL;
+    }
+    if (port_list) {
+        gp_port_info_list_free(port_list);
+        port_list = NULL;
+    }
+    registry_state = REGISTRY_EMPTY;
+    pthread_mutex_unlock(&registry_mutex);
+    pthread_rwlock_unlock(&lists_lock);
+}
+
+int gphoto_registry_abilities(const char *model, CameraAbilities *abilities) {
+    int ret = GP_ERROR_MODEL_NOT_FOUND;
+    int index;
+
+    if (registry_lock()) {
+        index = map_find(&models, model);
+        if (index >= 0) {
+            ret = gp_abilities_list_get_abilities(abilities_list, index, abilities);
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    return ret;
+}
+
+/*
+ * Specific USB paths like usb:001,005 aren't in the loaded list, libgphoto2 adds them to it on the
+ * first lookup. The hash map remembers them from then on. Adding one moves the list a scan may be
+ * reading, only that first lookup waits for a running scan.
+ */
+int gphoto_registry_port_info(const char *path, GPPortInfo *info) {
+    int ret = GP_ERROR_UNKNOWN_PORT;
+    int index = -1;
+
+    if (registry_lock()) {
+        index = map_find(&ports, path);
+        if (index >= 0) {
+            ret = gp_port_info_list_get_info(port_list, index, info);
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    if (index >= 0) {
+        return ret;
+    }
+
+    pthread_rwlock_wrlock(&lists_lock);
+    if (registry_lock()) {
+        index = map_find(&ports, path);
+        if (index < 0) {
+            index = gp_port_info_list_lookup_path(port_list, path);
+            if (index >= GP_OK) {
+                registry_add_port(index);
+            }
+        }
+        ret = index < GP_OK ? index : gp_port_info_list_get_info(port_list, index, info);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    pthread_rwlock_unlock(&lists_lock);
+    return ret;
+}
+
+int gphoto_registry_detect(CameraList *list, GPContext *context) {
+    CameraAbilitiesList *abilities = NULL;
+    GPPortInfoList *port_infos = NULL;
+    CameraList *detected = NULL;
+    const char *name, *path;
+    int ret = GP_ERROR;
+    int i, count;
+
+    /* The lists stay put while the read lock is held, the scan runs without registry_mutex. */
+    pthread_rwlock_rdlock(&lists_lock);
+    if (registry_lock()) {
+        abilities = abilities_list;
+        port_infos = port_list;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    if (abilities) {
+        ret = gp_list_new(&detected);
+        if (ret >= GP_OK) {
+            ret = gp_abilities_list_detect(abilities, port_infos, detected, context);
+        }
+    }
+    pthread_rwlock_unlock(&lists_lock);
+
+    if (ret >= GP_OK) {
+        /* Same as gp_camera_autodetect: the generic usb: entry is not a camera. */
+        count = gp_list_count(detected);
+        for (i = 0; i < count; i++) {
+            gp_list_get_name(detected, i, &name);
+            gp_list_get_value(detected, i, &path);
+            if (strcmp(path, "usb:") != 0) {
+                gp_list_append(list, name, path);
+            }
+        }
+        ret = gp_list_count(list);
+    }
+    if (detected) {
+        gp_list_free(detected);
+    }
+    return ret;
+}
+
+/* Whether a driver claims the USB id, cameras of generic classes like PTP are matched by class instead. */
+bool gphoto_registry_known_usb(int vendor, int product) {
+    char usb_key[16];
+    bool ret = false;
+
+    registry_usb_key(usb_key, sizeof(usb_key), vendor, product);
+    if (registry_lock()) {
+        ret = map_find(&usb_ids, usb_key) >= 0;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    return ret;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <gphoto2/gphoto2-camera.h>
+
+/*
+ * The camera drivers and port drivers of libgphoto2, loaded once for the whole module. Loading scans
+ * every camlib on disk, so it is started in the background at module load; the first user waits for
+ * it if it isn't done yet. Model and port lookups are served from hash maps under one lock, a bus
+ * scan doesn't hold it.
+ */
+void gphoto_registry_warm(void);
+void gphoto_registry_free(void);
+
+int gphoto_registry_abilities(const char *model, CameraAbilities *abilities);
+int gphoto_registry_port_info(const char *path, GPPortInfo *info);
+bool gphoto_registry_known_usb(int vendor, int product);
+
+/* gp_camera_autodetect without reloading the drivers every time. */
+int gphoto_registry_detect(CameraList *list, GPContext *context);
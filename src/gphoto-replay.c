@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <obs-module.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+
+#include "gphoto-replay.h"
+
+/*
+ * Replay cameras serve recorded files instead of talking to USB, so sources can be load tested
+ * without hardware. The directory holds:
+ *
+ *   preview/   live view JPEGs, replayed in name order at preview_fps and looped
+ *   stills/    photos handed out by capture and file added events, looped
+ *   camera.json (optional)
+ *       cameras               number of simulated cameras (1)
+ *       model                 camera name, numbered when there are several ("Replay Camera")
+ *       preview_fps           live view frame rate, faster polls see repeated frames (30)
+ *       init_latency_ms       (200), preview_latency_ms (15), capture_latency_ms (500),
+ *       download_latency_ms   (100), how long each call blocks
+ *       event_interval_ms     emit a file added event this often, 0 never (0)
+ *       config                widgets by name, e.g. "iso": {"type": "radio", "value": "100",
+ *                             "choices": "100|200|400"}. Types: text, range (min, max, step),
+ *                             toggle, radio, menu.
+ */
+
+#define REPLAY_FOLDER "/store_00010001/DCIM/100REPLY"
+
+struct replay_file {
+    uint8_t *data;
+    size_t size;
+};
+
+struct replay_recording {
+    struct replay_file *previews;
+    size_t preview_count;
+    struct replay_file *stills;
+    size_t still_count;
+
+    obs_data_t *config;
+    long long cameras;
+    char *model;
+    double preview_fps;
+    uint64_t init_latency;
+    uint64_t preview_latency;
+    uint64_t capture_latency;
+    uint64_t download_latency;
+    uint64_t event_interval;
+};
+
+struct replay_camera {
+    long long index;
+    obs_data_t *config;
+    uint64_t start;
+    uint64_t next_event;
+    uint64_t previews;
+    uint32_t captures;
+};
+
+static struct replay_recording replay;
+
+static const char *default_config =
+        "{"
+        "\"imageformat\": {\"label\": \"Image Format\", \"type\": \"radio\", \"value\": \"Large Fine JPEG\","
+        " \"choices\": \"Large Fine JPEG|Medium Fine JPEG|Small Fine JPEG\"},"
+        "\"shutterspeed\": {\"label\": \"Shutter Speed\", \"type\": \"radio\", \"value\": \"1/60\","
+        " \"choices\": \"1/30|1/60|1/125|1/250|1/500\"},"
+        "\"aperture\": {\"label\": \"Aperture\", \"type\": \"radio\", \"value\": \"5.6\","
+        " \"choices\": \"2.8|4|5.6|8|11\"},"
+        "\"iso\": {\"label\": \"ISO Speed\", \"type\": \"radio\", \"value\": \"400\","
+        " \"choices\": \"100|200|400|800|1600\"},"
+        "\"whitebalance\": {\"label\": \"WhiteBalance\", \"type\": \"radio\", \"value\": \"Auto\","
+        " \"choices\": \"Auto|Daylight|Shadow|Cloudy|Tungsten|Fluorescent\"},"
+        "\"picturestyle\": {\"label\": \"Picture Style\", \"type\": \"radio\", \"value\": \"Standard\","
+        " \"choices\": \"Standard|Portrait|Landscape|Neutral|Faithful|Monochrome\"},"
+        "\"autofocusdrive\": {\"label\": \"Drive Canon DSLR Autofocus\", \"type\": \"toggle\", \"value\": false},"
+        "\"cancelautofocus\": {\"label\": \"Cancel Canon DSLR Autofocus\", \"type\": \"toggle\", \"value\": false},"
+        "\"manualfocusdrive\": {\"label\": \"Drive Canon DSLR Manual focus\", \"type\": \"radio\","
+        " \"value\": \"None\", \"choices\": \"Near 1|Near 2|Near 3|None|Far 1|Far 2|Far 3\"}"
+        "}";
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static bool read_file(const char *path, struct replay_file *file) {
+    FILE *f = os_fopen(path, "rb");
+    long length;
+    bool ret = false;
+
+    if (!f) {
+        return false;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (length = ftell(f)) > 0) {
+        rewind(f);
+        file->data = bmalloc((size_t)length);
+        file->size = (size_t)length;
+        ret = fread(file->data, 1, file->size, f) == file->size;
+        if (!ret) {
+            bfree(file->data);
+            file->data = NULL;
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
+/* Loads every regular file of a directory in name order, recordings are numbered. */
+static size_t load_files(const char *dir, const char *sub, struct replay_file **files) {
+    struct dstr path = {0};
+    struct os_dirent *entry;
+    os_dir_t *os_dir;
+    char **names = NULL;
+    size_t count = 0, loaded = 0, i;
+
+    dstr_printf(&path, "%s/%s", dir, sub);
+    os_dir = os_opendir(path.array);
+    if (os_dir) {
+        while ((entry = os_readdir(os_dir))) {
+            if (!entry->directory && entry->d_name[0] != '.') {
+                names = brealloc(names, (count + 1) * sizeof(char *));
+                names[count++] = bstrdup(entry->d_name);
+            }
+        }
+        os_closedir(os_dir);
+    }
+
+    qsort(names, count, sizeof(char *), compare_names);
+    *files = count ? bzalloc(count * sizeof(struct replay_file)) : NULL;
+    for (i = 0; i < count; i++) {
+        dstr_printf(&path, "%s/%s/%s", dir, sub, names[i]);
+        if (read_file(path.array, &(*files)[loaded])) {
+            loaded++;
+        } else {
+            blog(LOG_WARNING, "Can't read replay file %s.\n", path.array);
+        }
+        bfree(names[i]);
+    }
+    bfree(names);
+    dstr_free(&path);
+    return loaded;
+}
+
+static void free_files(struct replay_file *files, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        bfree(files[i].data);
+    }
+    bfree(files);
+}
+
+bool gphoto_replay_load(const char *dir) {
+    struct dstr path = {0};
+    obs_data_t *settings = NULL;
+    obs_data_t *config;
+
+    gphoto_replay_unload();
+
+    dstr_printf(&path, "%s/camera.json", dir);
+    if (os_file_exists(path.array)) {
+        settings = obs_data_create_from_json_file(path.array);
+        if (!settings) {
+            blog(LOG_WARNING, "Can't parse %s.\n", path.array);
+        }
+    }
+    dstr_free(&path);
+    if (!settings) {
+        settings = obs_data_create();
+    }
+
+    obs_data_set_default_int(settings, "cameras", 1);
+    obs_data_set_default_string(settings, "model", "Replay Camera");
+    obs_data_set_default_double(settings, "preview_fps", 30.0);
+    obs_data_set_default_int(settings, "init_latency_ms", 200);
+    obs_data_set_default_int(settings, "preview_latency_ms", 15);
+    obs_data_set_default_int(settings, "capture_latency_ms", 500);
+    obs_data_set_default_int(settings, "download_latency_ms", 100);
+    obs_data_set_default_int(settings, "event_interval_ms", 0);
+
+    replay.cameras = obs_data_get_int(settings, "cameras");
+    replay.model = bstrdup(obs_data_get_string(settings, "model"));
+    replay.preview_fps = obs_data_get_double(settings, "preview_fps");
+    replay.init_latency = (uint64_t)obs_data_get_int(settings, "init_latency_ms") * 1000000;
+    replay.preview_latency = (uint64_t)obs_data_get_int(settings, "preview_latency_ms") * 1000000;
+    replay.capture_latency = (uint64_t)obs_data_get_int(settings, "capture_latency_ms") * 1000000;
+    replay.download_latency = (uint64_t)obs_data_get_int(settings, "download_latency_ms") * 1000000;
+    replay.event_interval = (uint64_t)obs_data_get_int(settings, "event_interval_ms") * 1000000;
+
+    config = obs_data_get_obj(settings, "config");
+    replay.config = config ? config : obs_data_create_from_json(default_config);
+    obs_data_release(settings);
+
+    replay.preview_count = load_files(dir, "preview", &replay.previews);
+    replay.still_count = load_files(dir, "stills", &replay.stills);
+    blog(LOG_INFO, "Replay: %lld cameras, %zu preview frames, %zu stills from %s.\n", replay.cameras,
+         replay.preview_count, replay.still_count, dir);
+
+    if (replay.cameras < 1 || (!replay.preview_count && !replay.still_count)) {
+        gphoto_replay_unload();
+        return false;
+    }
+    return true;
+}
+
+void gphoto_replay_unload(void) {
+    free_files(replay.previews, replay.preview_count);
+    free_files(replay.stills, replay.still_count);
+    obs_data_release(replay.config);
+    bfree(replay.model);
+    memset(&replay, 0, sizeof(struct replay_recording));
+}
+
+static void replay_camera_name(struct dstr *name, long long index) {
+    if (replay.cameras > 1) {
+        dstr_printf(name, "%s #%lld", replay.model, index);
+    } else {
+        dstr_copy(name, replay.model);
+    }
+}
+
+static int replay_autodetect(CameraList *list, GPContext *context) {
+    UNUSED_PARAMETER(context);
+    struct dstr name = {0};
+    struct dstr port = {0};
+    long long i;
+
+    gp_list_reset(list);
+    for (i = 1; i <= replay.cameras; i++) {
+        replay_camera_name(&name, i);
+        dstr_printf(&port, "replay:%lld", i);
+        gp_list_append(list, name.array, port.array);
+    }
+    dstr_free(&name);
+    dstr_free(&port);
+    return (int)replay.cameras;
+}
+
+static int replay_open(void **impl, const char *model, const char *port, GPContext *context) {
+    UNUSED_PARAMETER(model);
+    UNUSED_PARAMETER(context);
+    struct replay_camera *camera;
+    long long index;
+
+    if (sscanf(port, "replay:%lld", &index) != 1 || index < 1 || index > replay.cameras) {
+        return GP_ERROR_UNKNOWN_PORT;
+    }
+
+    camera = bzalloc(sizeof(struct replay_camera));
+    camera->index = index;
+    /* Every camera has its own settings, a deep copy of the recording's. */
+    camera->config = obs_data_create_from_json(obs_data_get_json(replay.config));
+    *impl = camera;
+    return GP_OK;
+}
+
+static int replay_init(void *impl, GPContext *context) {
+    UNUSED_PARAMETER(context);
+    struct replay_camera *camera = impl;
+
+    os_sleepto_ns(os_gettime_ns() + replay.init_latency);
+    camera->start = os_gettime_ns();
+    camera->next_event = camera->start + replay.event_interval;
+    return GP_OK;
+}
+
+static int replay_exit(void *impl, GPContext *context) {
+    UNUSED_PARAMETER(impl);
+    UNUSED_PARAMETER(context);
+    return GP_OK;
+}
+
+static void replay_free(void *impl) {
+    struct replay_camera *camera = impl;
+
+    obs_data_release(camera->config);
+    bfree(camera);
+}
+
+static int replay_capture_preview(void *impl, CameraFile *file, GPContext *context) {
+    UNUSED_PARAMETER(context);
+    struct replay_camera *camera = impl;
+    struct replay_file *frame;
+    uint64_t now, index;
+
+    if (!replay.preview_count) {
+        return GP_ERROR_NOT_SUPPORTED;
+    }
+
+    os_sleepto_ns(os_gettime_ns() + replay.preview_latency);
+
+    /* Like a real camera the frame only changes at preview_fps, no matter how often it's asked. */
+    now = os_gettime_ns();
+    if (replay.preview_fps > 0.0) {
+        index = (uint64_t)((double)(now - camera->start) * replay.preview_fps / 1000000000.0);
+    } else {
+        index = camera->previews;
+    }
+    camera->previews++;
+
+    frame = &replay.previews[index % replay.preview_count];
+    return gp_file_append(file, (const char *)frame->data, frame->size);
+}
+
+static void replay_next_path(struct replay_camera *camera, CameraFilePath *path) {
+    snprintf(path->folder, sizeof(path->folder), "%s", REPLAY_FOLDER);
+    snprintf(path->name, sizeof(path->name), "IMG_%04u.JPG", camera->captures++ % 10000);
+}
+
+static int replay_capture(void *impl, CameraCaptureType type, CameraFilePath *path, GPContext *context) {
+    UNUSED_PARAMETER(context);
+    struct replay_camera *camera = impl;
+
+    if (type != GP_CAPTURE_IMAGE || !replay.still_count) {
+        return GP_ERROR_NOT_SUPPORTED;
+    }
+
+    os_sleepto_ns(os_gettime_ns() + replay.capture_latency);
+    replay_next_path(camera, path);
+    return GP_OK;
+}
+
+static int replay_file_get(void *impl, const char *folder, const char *name, CameraFileType type,
+                           CameraFile *file, GPContext *context) {
+    UNUSED_PARAMETER(impl);
+    UNUSED_PARAMETER(context);
+    struct replay_file *still;
+    unsigned int index;
+
+    if (strcmp(folder, REPLAY_FOLDER) != 0 || sscanf(name, "IMG_%u.JPG", &index) != 1) {
+        return GP_ERROR_FILE_NOT_FOUND;
+    }
+    if (type != GP_FILE_TYPE_NORMAL || !replay.still_count) {
+        return GP_ERROR_NOT_SUPPORTED;
+    }
+
+    os_sleepto_ns(os_gettime_ns() + replay.download_latency);
+    still = &replay.stills[index % replay.still_count];
+    return gp_file_append(file, (const char *)still->data, still->size);
+}
+
+static int replay_file_delete(void *impl, const char *folder, const char *name, GPContext *context) {
+    UNUSED_PARAMETER(impl);
+    UNUSED_PARAMETER(folder);
+    UNUSED_PARAMETER(name);
+    UNUSED_PARAMETER(context);
+    return GP_OK;
+}
+
+static int replay_wait_for_event(void *impl, int timeout, CameraEventType *type, void **data, GPContext *context) {
+    UNUSED_PARAMETER(context);
+    struct replay_camera *camera = impl;
+    uint64_t deadline = os_gettime_ns() + (uint64_t)timeout * 1000000;
+    CameraFilePath *path;
+
+    *data = NULL;
+    if (replay.event_interval && replay.still_count && camera->next_event <= deadline) {
+        os_sleepto_ns(camera->next_event);
+        camera->next_event += replay.event_interval;
+
+        /* Freed by the caller, like libgphoto2's event data. */
+        path = malloc(sizeof(CameraFilePath));
+        replay_next_path(camera, path);
+        *type = GP_EVENT_FILE_ADDED;
+        *data = path;
+        return GP_OK;
+    }
+
+    os_sleepto_ns(deadline);
+    *type = GP_EVENT_TIMEOUT;
+    return GP_OK;
+}
+
+static CameraWidgetType replay_widget_type(const char *type) {
+    if (strcmp(type, "range") == 0) {
+        return GP_WIDGET_RANGE;
+    } else if (strcmp(type, "toggle") == 0) {
+        return GP_WIDGET_TOGGLE;
+    } else if (strcmp(type, "radio") == 0) {
+        return GP_WIDGET_RADIO;
+    } else if (strcmp(type, "menu") == 0) {
+        return GP_WIDGET_MENU;
+    }
+    return GP_WIDGET_TEXT;
+}
+
+static int replay_get_single_config(void *impl, const char *name, CameraWidget **widget, GPContext *context) {
+    UNUSED_PARAMETER(context);
+    struct replay_camera *camera = impl;
+    obs_data_t *item = obs_data_get_obj(camera->config, name);
+    CameraWidgetType type;
+    char **choices;
+    float range;
+    int toggle;
+    size_t i;
+
+    if (!item) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+
+    type = replay_widget_type(obs_data_get_string(item, "type"));
+    gp_widget_new(type, obs_data_get_string(item, "label"), widget);
+    gp_widget_set_name(*widget, name);
+    switch (type) {
+        case GP_WIDGET_RANGE:
+            gp_widget_set_range(*widget, (float)obs_data_get_double(item, "min"),
+                                (float)obs_data_get_double(item, "max"), (float)obs_data_get_double(item, "step"));
+            range = (float)obs_data_get_double(item, "value");
+            gp_widget_set_value(*widget, &range);
+            break;
+        case GP_WIDGET_TOGGLE:
+            toggle = obs_data_get_bool(item, "value");
+            gp_widget_set_value(*widget, &toggle);
+            break;
+        case GP_WIDGET_RADIO:
+        case GP_WIDGET_MENU:
+            choices = strlist_split(obs_data_get_string(item, "choices"), '|', false);
+            for (i = 0; choices && choices[i]; i++) {
+                gp_widget_add_choice(*widget, choices[i]);
+            }
+            strlist_free(choices);
+            gp_widget_set_value(*widget, obs_data_get_string(item, "value"));
+            break;
+        default:
+            gp_widget_set_value(*widget, obs_data_get_string(item, "value"));
+            break;
+    }
+
+    obs_data_release(item);
+    return GP_OK;
+}
+
+/* Every configured widget in one window, in the order of camera.json. */
+static int replay_get_config(void *impl, CameraWidget **window, GPContext *context) {
+    struct replay_camera *camera = impl;
+    obs_data_item_t *item;
+    CameraWidget *widget;
+
+    gp_widget_new(GP_WIDGET_WINDOW, "Camera and Driver Configuration", window);
+    for (item = obs_data_first(camera->config); item; obs_data_item_next(&item)) {
+        if (replay_get_single_config(impl, obs_data_item_get_name(item), &widget, context) == GP_OK) {
+            gp_widget_append(*window, widget);
+        }
+    }
+    return GP_OK;
+}
+
+static int replay_set_single_config(void *impl, const char *name, CameraWidget *widget, GPContext *context) {
+    UNUSED_PARAMETER(context);
+    struct replay_camera *camera = impl;
+    obs_data_t *item = obs_data_get_obj(camera->config, name);
+    CameraWidgetType type;
+    const char *text = NULL;
+    float range;
+    int toggle;
+
+    if (!item) {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+
+    gp_widget_get_type(widget, &type);
+    switch (type) {
+        case GP_WIDGET_RANGE:
+            gp_widget_get_value(widget, &range);
+            obs_data_set_double(item, "value", range);
+            break;
+        case GP_WIDGET_TOGGLE:
+            gp_widget_get_value(widget, &toggle);
+            obs_data_set_bool(item, "value", toggle != 0);
+            break;
+        default:
+            gp_widget_get_value(widget, &text);
+            obs_data_set_string(item, "value", text ? text : "");
+            break;
+    }
+
+    obs_data_release(item);
+    return GP_OK;
+}
+
+/* Like the PTP driver: only the widgets changed since they were read are written. */
+static int replay_set_config(void *impl, CameraWidget *window, GPContext *context) {
+    CameraWidget *widget;
+    const char *name;
+    int i, count, ret = GP_OK;
+
+    count = gp_widget_count_children(window);
+    for (i = 0; i < count; i++) {
+        if (gp_widget_get_child(window, i, &widget) == GP_OK && gp_widget_changed(widget) &&
+            gp_widget_get_name(widget, &name) == GP_OK &&
+            replay_set_single_config(impl, name, widget, context) < GP_OK) {
+            ret = GP_ERROR_BAD_PARAMETERS;
+        }
+    }
+    return ret;
+}
+
+static const struct gphoto_backend replay_backend = {
+    .name = "replay",
+    .autodetect = replay_autodetect,
+    .open = replay_open,
+    .init = replay_init,
+    .exit = replay_exit,
+    .free = replay_free,
+    .capture_preview = replay_capture_preview,
+    .capture = replay_capture,
+    .file_get = replay_file_get,
+    .file_delete = replay_file_delete,
+    .wait_for_event = replay_wait_for_event,
+    .get_config = replay_get_config,
+    .set_config = replay_set_config,
+    .get_single_config = replay_get_single_config,
+    .set_single_config = replay_set_single_config,
+};
+
+const struct gphoto_backend *gphoto_replay_backend(void) {
+    return &replay_backend;
+}
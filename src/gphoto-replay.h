@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "gphoto-backend.h"
+
+bool gphoto_replay_load(const char *dir);
+void gphoto_replay_unload(void);
+const struct gphoto_backend *gphoto_replay_backend(void);
@@ -0,0 +1,93 @@
+#include <obs-module.h>
+
+#include "gphoto-ring.h"
+
+void preview_ring_init(struct preview_ring *ring, size_t capacity) {
+    pthread_mutex_init(&ring->mutex, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+    ring->blobs = bzalloc(capacity * sizeof(struct preview_blob));
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->count = 0;
+    ring->stopped = false;
+    ring->popped = 0;
+    ring->dropped = 0;
+    ring->allocs = 0;
+}
+
+void preview_ring_free(struct preview_ring *ring) {
+    size_t i;
+
+    for (i = 0; i < ring->capacity; i++) {
+        preview_blob_free(&ring->blobs[i]);
+    }
+    bfree(ring->blobs);
+    ring->blobs = NULL;
+    pthread_cond_destroy(&ring->cond);
+    pthread_mutex_destroy(&ring->mutex);
+}
+
+void preview_blob_free(struct preview_blob *blob) {
+    bfree(blob->data);
+    blob->data = NULL;
+    blob->size = 0;
+    blob->capacity = 0;
+}
+
+void preview_ring_push(struct preview_ring *ring, const uint8_t *data, size_t size, uint64_t timestamp) {
+    struct preview_blob *blob;
+
+    pthread_mutex_lock(&ring->mutex);
+
+    /* Live view wants the newest frame, so a full ring drops its oldest entry. */
+    if (ring->count == ring->capacity) {
+        ring->head = (ring->head + 1) % ring->capacity;
+        ring->count--;
+        ring->dropped++;
+    }
+
+    blob = &ring->blobs[(ring->head + ring->count) % ring->capacity];
+    if (blob->capacity < size) {
+        bfree(blob->data);
+        blob->data = bmalloc(size);
+        blob->capacity = size;
+        ring->allocs++;
+    }
+    memcpy(blob->data, data, size);
+    blob->size = size;
+    blob->timestamp = timestamp;
+    ring->count++;
+
+    pthread_cond_signal(&ring->cond);
+    pthread_mutex_unlock(&ring->mutex);
+}
+
+bool preview_ring_pop(struct preview_ring *ring, struct preview_blob *blob) {
+    struct preview_blob tmp;
+    bool ret = false;
+
+    pthread_mutex_lock(&ring->mutex);
+    while (ring->count == 0 && !ring->stopped) {
+        pthread_cond_wait(&ring->cond, &ring->mutex);
+    }
+
+    if (!ring->stopped) {
+        tmp = ring->blobs[ring->head];
+        ring->blobs[ring->head] = *blob;
+        *blob = tmp;
+        blob->sequence = ring->popped++;
+        ring->head = (ring->head + 1) % ring->capacity;
+        ring->count--;
+        ret = true;
+    }
+    pthread_mutex_unlock(&ring->mutex);
+
+    return ret;
+}
+
+void preview_ring_stop(struct preview_ring *ring) {
+    pthread_mutex_lock(&ring->mutex);
+    ring->stopped = true;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->mutex);
+}
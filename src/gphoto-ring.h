@@ -0,0 +1,40 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct preview_blob {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    uint64_t timestamp;
+    uint64_t sequence;
+};
+
+/*
+ * Bounded queue of raw preview blobs between the USB fetch and the decode stage. Buffers are
+ * recycled: push copies into a slot, pop swaps the slot with the consumer's blob. Popped blobs are
+ * numbered without gaps in capture order, so parallel consumers can put them back in order.
+ */
+struct preview_ring {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct preview_blob *blobs;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool stopped;
+    uint64_t popped;
+
+    uint64_t dropped;
+    long allocs;
+};
+
+void preview_ring_init(struct preview_ring *ring, size_t capacity);
+void preview_ring_free(struct preview_ring *ring);
+void preview_ring_push(struct preview_ring *ring, const uint8_t *data, size_t size, uint64_t timestamp);
+bool preview_ring_pop(struct preview_ring *ring, struct preview_blob *blob);
+void preview_ring_stop(struct preview_ring *ring);
+void preview_blob_free(struct preview_blob *blob);
@@ -0,0 +1,260 @@
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "gphoto-session.h"
+#include "gphoto-trace.h"
+#include "gphoto-utils.h"
+
+#define PREVIEW_FINGERPRINT_SAMPLES 256
+#define PREVIEW_FINGERPRINT_TAIL 32
+
+static void decoder_init_frame(struct preview_decoder *decoder, uint32_t width, uint32_t height,
+                               enum video_format format) {
+    struct obs_source_frame *frame = &decoder->frame;
+    uint32_t plane_height[3];
+
+    frame->width = width;
+    frame->height = height;
+    if (format == VIDEO_FORMAT_I420) {
+        /* Live view JPEG is full range BT.601 YCbCr, pass it through untouched. */
+        frame->format = VIDEO_FORMAT_I420;
+        gphoto_jpeg_i420_layout(width, height, frame->linesize, plane_height);
+        decoder->frame_data = bmalloc(frame->linesize[0] * plane_height[0] +
+                                      2 * frame->linesize[1] * plane_height[1]);
+        frame->data[0] = decoder->frame_data;
+        frame->data[1] = frame->data[0] + frame->linesize[0] * plane_height[0];
+        frame->data[2] = frame->data[1] + frame->linesize[1] * plane_height[1];
+        frame->full_range = true;
+        video_format_get_parameters(VIDEO_CS_601, VIDEO_RANGE_FULL, frame->color_matrix,
+                                    frame->color_range_min, frame->color_range_max);
+    } else {
+        frame->format = VIDEO_FORMAT_BGRX;
+        frame->linesize[0] = width * 4;
+        decoder->frame_data = bmalloc(frame->linesize[0] * height);
+        frame->data[0] = decoder->frame_data;
+    }
+}
+
+void preview_session_init(struct preview_session *session, uint32_t lv_width, uint32_t lv_height,
+                          uint32_t scale, enum video_format format, size_t depth) {
+    uint32_t width = gphoto_jpeg_scaled(lv_width, scale);
+    uint32_t height = gphoto_jpeg_scaled(lv_height, scale);
+    size_t i;
+
+    memset(session, 0, sizeof(struct preview_session));
+
+    /* More queued frames than decoders would only add latency. */
+    preview_ring_init(&session->ring, depth);
+    pthread_mutex_init(&session->output_mutex, NULL);
+    pthread_cond_init(&session->output_cond, NULL);
+    session->scale = scale;
+    session->depth = depth;
+    session->decoders = bzalloc(depth * sizeof(struct preview_decoder));
+    for (i = 0; i < depth; i++) {
+        session->decoders[i].session = session;
+        session->decoders[i].decoder = gphoto_jpeg_decoder_create();
+        decoder_init_frame(&session->decoders[i], width, height, format);
+    }
+}
+
+void preview_session_free(struct preview_session *session) {
+    size_t i;
+
+    if (session->frames) {
+        blog(LOG_INFO, "Preview session: %llu frames, %zu decode threads, %ld plugin buffer allocations, "
+                       "%llu dropped.\n",
+             (unsigned long long)session->frames, session->depth, preview_session_buffer_allocs(session),
+             (unsigned long long)session->ring.dropped);
+    }
+
+    if (session->ring.blobs) {
+        preview_ring_free(&session->ring);
+        pthread_cond_destroy(&session->output_cond);
+        pthread_mutex_destroy(&session->output_mutex);
+    }
+    for (i = 0; i < session->depth; i++) {
+        preview_blob_free(&session->decoders[i].blob);
+        gphoto_jpeg_decoder_destroy(session->decoders[i].decoder);
+        bfree(session->decoders[i].frame_data);
+    }
+    bfree(session->decoders);
+    session->decoders = NULL;
+    session->depth = 0;
+}
+
+/*
+ * Decodes in parallel with the other threads, then waits for its turn so frames leave in the
+ * order they were captured. A failed decode still passes the turn on.
+ */
+static void *decode_thread(void *vptr) {
+    struct preview_decoder *decoder = vptr;
+    struct preview_session *session = decoder->session;
+    uint64_t start, end, convert_time;
+    bool decoded;
+
+    gphoto_trace_thread_name("preview decode");
+    while (preview_ring_pop(&session->ring, &decoder->blob)) {
+        decoder->frame.timestamp = decoder->blob.timestamp;
+        start = os_gettime_ns();
+        decoded = gphoto_decode_preview(decoder->decoder, decoder->blob.data, decoder->blob.size,
+                                        session->scale, &decoder->frame, &convert_time);
+        end = os_gettime_ns();
+        if (decoded) {
+            gphoto_stats_record_decode(session->stats, start, end, convert_time);
+        }
+        gphoto_trace_span("decode", start, end);
+
+        start = gphoto_trace_now();
+        pthread_mutex_lock(&session->output_mutex);
+        while (session->next_output != decoder->blob.sequence) {
+            pthread_cond_wait(&session->output_cond, &session->output_mutex);
+        }
+        gphoto_trace_end("order wait", start);
+        if (decoded) {
+            start = os_gettime_ns();
+            session->output(session->output_param, &decoder->frame);
+            end = os_gettime_ns();
+            gphoto_stats_record(session->stats, GPHOTO_STAGE_OUTPUT, end - start);
+            gphoto_trace_span("output", start, end);
+            session->frames++;
+        }
+        session->next_output++;
+        pthread_cond_broadcast(&session->output_cond);
+        pthread_mutex_unlock(&session->output_mutex);
+    }
+
+    return NULL;
+}
+
+void preview_session_start(struct preview_session *session, preview_output_t output, void *param,
+                           struct gphoto_stats *stats) {
+    size_t i;
+
+    session->output = output;
+    session->output_param = param;
+    session->stats = stats;
+    for (i = 0; i < session->depth; i++) {
+        pthread_create(&session->decoders[i].thread, NULL, decode_thread, &session->decoders[i]);
+    }
+}
+
+/* Every popped blob is owned by a running thread that will pass its turn on, so joining can't hang. */
+void preview_session_stop(struct preview_session *session) {
+    size_t i;
+
+    preview_ring_stop(&session->ring);
+    for (i = 0; i < session->depth; i++) {
+        if (session->decoders[i].thread != 0) {
+            pthread_join(session->decoders[i].thread, NULL);
+            session->decoders[i].thread = 0;
+        }
+    }
+}
+
+bool preview_fetch_init(struct preview_fetch *fetch) {
+    memset(fetch, 0, sizeof(struct preview_fetch));
+    if (gp_file_new(&fetch->cam_file) < GP_OK) {
+        blog(LOG_WARNING, "Can't create the live view camera file.\n");
+        return false;
+    }
+    return true;
+}
+
+void preview_fetch_free(struct preview_fetch *fetch) {
+    if (fetch->fetched) {
+        blog(LOG_INFO, "Preview fetch: %llu of %llu fetched frames were duplicates (%.1f%%).\n",
+             (unsigned long long)fetch->duplicates, (unsigned long long)fetch->fetched,
+             preview_fetch_duplicate_rate(fetch));
+    }
+    if (fetch->cam_file) {
+        gp_file_free(fetch->cam_file);
+        fetch->cam_file = NULL;
+    }
+}
+
+int preview_fetch_capture(struct preview_fetch *fetch, struct gphoto_camera *camera, GPContext *context) {
+    gp_file_clean(fetch->cam_file);
+    return gphoto_camera_capture_preview(camera, fetch->cam_file, context);
+}
+
+bool preview_fetch_data(struct preview_fetch *fetch, const uint8_t **data, size_t *size) {
+    const char *image_data = NULL;
+    unsigned long data_size = 0;
+
+    if (gp_file_get_data_and_size(fetch->cam_file, &image_data, &data_size) < GP_OK || data_size == 0) {
+        blog(LOG_WARNING, "Can't get image data.\n");
+        return false;
+    }
+    *data = (const uint8_t *)image_data;
+    *size = data_size;
+    return true;
+}
+
+/*
+ * Length plus FNV-1a over a fixed number of evenly spread samples and the tail. The JPEG headers
+ * are identical across frames, but any change in the scene shifts the entropy coded data and
+ * almost always the length.
+ */
+static uint64_t blob_fingerprint(const uint8_t *data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL ^ size;
+    size_t i, step, tail;
+
+    step = size / PREVIEW_FINGERPRINT_SAMPLES;
+    if (step == 0) {
+        step = 1;
+    }
+    for (i = 0; i < size; i += step) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+
+    tail = size < PREVIEW_FINGERPRINT_TAIL ? size : PREVIEW_FINGERPRINT_TAIL;
+    for (i = size - tail; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool preview_fetch_check_fresh(struct preview_fetch *fetch) {
+    const uint8_t *image_data;
+    size_t data_size;
+    uint64_t fingerprint;
+
+    if (!preview_fetch_data(fetch, &image_data, &data_size)) {
+        return false;
+    }
+
+    fetch->fetched++;
+    fingerprint = blob_fingerprint(image_data, data_size);
+    if (fetch->fetched > 1 && fingerprint == fetch->fingerprint) {
+        fetch->duplicates++;
+        return false;
+    }
+    fetch->fingerprint = fingerprint;
+    return true;
+}
+
+void preview_session_queue(struct preview_session *session, const uint8_t *data, size_t size, uint64_t timestamp) {
+    preview_ring_push(&session->ring, data, size, timestamp);
+}
+
+/*
+ * (Re)allocations of the plugin's own buffers since init: ring slots and decoder scratch rows.
+ * libjpeg's pools and the CameraFile libgphoto2 fills allocate on their own and aren't counted.
+ * Grows only while the buffers settle, then stays flat.
+ */
+long preview_session_buffer_allocs(struct preview_session *session) {
+    long allocs = session->ring.allocs;
+    size_t i;
+
+    for (i = 0; i < session->depth; i++) {
+        allocs += gphoto_jpeg_decoder_allocs(session->decoders[i].decoder);
+    }
+    return allocs;
+}
+
+double preview_fetch_duplicate_rate(struct preview_fetch *fetch) {
+    if (!fetch->fetched) {
+        return 0.0;
+    }
+    return 100.0 * (double)fetch->duplicates / (double)fetch->fetched;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <obs-module.h>
+#include <pthread.h>
+#include <gphoto2/gphoto2-camera.h>
+
+#include "gphoto-backend.h"
+#include "gphoto-jpeg.h"
+#include "gphoto-ring.h"
+#include "gphoto-stats.h"
+
+struct preview_session;
+
+typedef void (*preview_output_t)(void *param, struct obs_source_frame *frame);
+
+/* One decode thread, with its own decompressor and output frame. */
+struct preview_decoder {
+    struct preview_session *session;
+    pthread_t thread;
+
+    struct gphoto_jpeg_decoder *decoder;
+    struct preview_blob blob;
+    struct obs_source_frame frame;
+    uint8_t *frame_data;
+};
+
+/* The USB side of a live view: the fetch buffer and the filter for repeated frames. One fetch can
+ * feed several sessions. */
+struct preview_fetch {
+    CameraFile *cam_file;
+    uint64_t fingerprint;
+    uint64_t fetched;
+    uint64_t duplicates;
+};
+
+/*
+ * Everything a running live preview decode needs per frame, allocated once when the stream starts.
+ * Every decode thread owns its preview_decoder. Up to depth frames are decoded at the same time and
+ * handed to the output in capture order.
+ */
+struct preview_session {
+    struct preview_ring ring;
+
+    preview_output_t output;
+    void *output_param;
+    struct gphoto_stats *stats;
+    uint32_t scale;
+    struct preview_decoder *decoders;
+    size_t depth;
+
+    pthread_mutex_t output_mutex;
+    pthread_cond_t output_cond;
+    uint64_t next_output;
+    uint64_t frames;
+};
+
+void preview_session_init(struct preview_session *session, uint32_t lv_width, uint32_t lv_height,
+                          uint32_t scale, enum video_format format, size_t depth);
+void preview_session_free(struct preview_session *session);
+void preview_session_start(struct preview_session *session, preview_output_t output, void *param,
+                           struct gphoto_stats *stats);
+void preview_session_stop(struct preview_session *session);
+
+void preview_session_queue(struct preview_session *session, const uint8_t *data, size_t size, uint64_t timestamp);
+/* Only the plugin's own buffers, see gphoto-session.c. */
+long preview_session_buffer_allocs(struct preview_session *session);
+
+bool preview_fetch_init(struct preview_fetch *fetch);
+void preview_fetch_free(struct preview_fetch *fetch);
+int preview_fetch_capture(struct preview_fetch *fetch, struct gphoto_camera *camera, GPContext *context);
+bool preview_fetch_data(struct preview_fetch *fetch, const uint8_t **data, size_t *size);
+bool preview_fetch_check_fresh(struct preview_fetch *fetch);
+double preview_fetch_duplicate_rate(struct preview_fetch *fetch);
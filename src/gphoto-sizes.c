@@ -0,0 +1,87 @@
+#include <obs-module.h>
+#include <pthread.h>
+#include <util/platform.h>
+
+#include "gphoto-sizes.h"
+
+static pthread_mutex_t sizes_mutex = PTHREAD_MUTEX_INITIALIZER;
+static obs_data_t *sizes = NULL;
+static char *sizes_path = NULL;
+
+void gphoto_sizes_load(void) {
+    char *dir = obs_module_config_path("");
+
+    if (dir) {
+        os_mkdirs(dir);
+        bfree(dir);
+    }
+    sizes_path = obs_module_config_path("sizes.json");
+    if (sizes_path && os_file_exists(sizes_path)) {
+        sizes = obs_data_create_from_json_file_safe(sizes_path, "bak");
+        if (!sizes) {
+            blog(LOG_WARNING, "Can't parse %s, frame sizes are probed again.\n", sizes_path);
+        }
+    }
+    if (!sizes) {
+        sizes = obs_data_create();
+    }
+}
+
+void gphoto_sizes_free(void) {
+    obs_data_release(sizes);
+    sizes = NULL;
+    bfree(sizes_path);
+    sizes_path = NULL;
+}
+
+bool gphoto_sizes_get(const char *model, const char *format, struct gphoto_frame_size *size) {
+    obs_data_t *camera, *entry;
+    bool ret = false;
+
+    pthread_mutex_lock(&sizes_mutex);
+    camera = obs_data_get_obj(sizes, model);
+    if (camera) {
+        entry = obs_data_get_obj(camera, format);
+        if (entry) {
+            size->width = (uint32_t)obs_data_get_int(entry, "width");
+            size->height = (uint32_t)obs_data_get_int(entry, "height");
+            size->jpeg = obs_data_get_bool(entry, "jpeg");
+            ret = size->width > 0 && size->height > 0;
+            obs_data_release(entry);
+        }
+        obs_data_release(camera);
+    }
+    pthread_mutex_unlock(&sizes_mutex);
+
+    return ret;
+}
+
+/* Writes the file only when the entry changed, which is once per model and format in practice. */
+void gphoto_sizes_set(const char *model, const char *format, const struct gphoto_frame_size *size) {
+    struct gphoto_frame_size old;
+    obs_data_t *camera, *entry;
+
+    if (gphoto_sizes_get(model, format, &old) && old.width == size->width && old.height == size->height &&
+        old.jpeg == size->jpeg) {
+        return;
+    }
+
+    pthread_mutex_lock(&sizes_mutex);
+    camera = obs_data_get_obj(sizes, model);
+    if (!camera) {
+        camera = obs_data_create();
+        obs_data_set_obj(sizes, model, camera);
+    }
+    entry = obs_data_create();
+    obs_data_set_int(entry, "width", size->width);
+    obs_data_set_int(entry, "height", size->height);
+    obs_data_set_bool(entry, "jpeg", size->jpeg);
+    obs_data_set_obj(camera, format, entry);
+    obs_data_release(entry);
+    obs_data_release(camera);
+
+    if (sizes_path && !obs_data_save_json_safe(sizes, sizes_path, "tmp", "bak")) {
+        blog(LOG_WARNING, "Can't write %s.\n", sizes_path);
+    }
+    pthread_mutex_unlock(&sizes_mutex);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Format key of the live view stream, stills are keyed by the camera's imageformat setting. */
+#define GPHOTO_SIZES_LIVE_VIEW "live view"
+
+struct gphoto_frame_size {
+    uint32_t width;
+    uint32_t height;
+    bool jpeg;
+};
+
+/*
+ * Last frame size seen per camera model and image format, kept in sizes.json in the module config
+ * directory. Lets a source size itself as soon as the camera is open instead of capturing a probe
+ * frame, the first real frame corrects a stale entry.
+ */
+void gphoto_sizes_load(void);
+void gphoto_sizes_free(void);
+
+bool gphoto_sizes_get(const char *model, const char *format, struct gphoto_frame_size *size);
+void gphoto_sizes_set(const char *model, const char *format, const struct gphoto_frame_size *size);
@@ -0,0 +1,167 @@
+#include <util/platform.h>
+
+#include "gphoto-stats.h"
+
+static const char *stage_names[GPHOTO_STAGE_COUNT] = {"queue wait", "capture", "fetch", "decode", "convert", "output"};
+
+static size_t bucket_index(uint64_t duration) {
+    uint64_t us = duration / 1000;
+    size_t index;
+
+    if (us < 2) {
+        return 0;
+    }
+    index = (size_t)(63 - __builtin_clzll(us));
+    return index < GPHOTO_STATS_BUCKETS ? index : GPHOTO_STATS_BUCKETS - 1;
+}
+
+/* Bucket bounds in ns. */
+static double bucket_low(size_t index) {
+    return index == 0 ? 0.0 : (double)(1ULL << index) * 1000.0;
+}
+
+static double bucket_high(size_t index) {
+    return (double)(1ULL << (index + 1)) * 1000.0;
+}
+
+static void update_max(uint64_t *max, uint64_t value) {
+    uint64_t current = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+    while (value > current &&
+           !__atomic_compare_exchange_n(max, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void gphoto_stats_reset(struct gphoto_stats *stats) {
+    memset(stats, 0, sizeof(struct gphoto_stats));
+    stats->next_log = os_gettime_ns() + GPHOTO_STATS_LOG_INTERVAL;
+}
+
+void gphoto_stats_record(struct gphoto_stats *stats, enum gphoto_stage stage, uint64_t duration) {
+    struct gphoto_histogram *histogram = &stats->stages[stage];
+
+    __atomic_fetch_add(&histogram->buckets[bucket_index(duration)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->total, duration, __ATOMIC_RELAXED);
+    update_max(&histogram->max, duration);
+    update_max(&histogram->window_max, duration);
+}
+
+/* Splits a decode into its decode and convert parts, convert_time is 0 when conversion was fused. */
+void gphoto_stats_record_decode(struct gphoto_stats *stats, uint64_t start, uint64_t end, uint64_t convert_time) {
+    gphoto_stats_record(stats, GPHOTO_STAGE_DECODE, end - start - convert_time);
+    if (convert_time) {
+        gphoto_stats_record(stats, GPHOTO_STAGE_CONVERT, convert_time);
+    }
+}
+
+static void histogram_snapshot(struct gphoto_histogram *histogram, struct gphoto_histogram *snapshot) {
+    size_t i;
+
+    for (i = 0; i < GPHOTO_STATS_BUCKETS; i++) {
+        snapshot->buckets[i] = __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+    }
+    snapshot->count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+    snapshot->total = __atomic_load_n(&histogram->total, __ATOMIC_RELAXED);
+    snapshot->max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    snapshot->window_max = 0;
+}
+
+/* Interpolates inside the bucket holding the rank, never above the largest sample. */
+static double histogram_percentile(const struct gphoto_histogram *histogram, double percentile) {
+    double rank = percentile / 100.0 * (double)histogram->count;
+    double value = 0.0;
+    uint64_t seen = 0;
+    size_t i;
+
+    for (i = 0; i < GPHOTO_STATS_BUCKETS; i++) {
+        if (histogram->buckets[i] && (double)(seen + histogram->buckets[i]) >= rank) {
+            value = bucket_low(i) + (bucket_high(i) - bucket_low(i)) * (rank - (double)seen) /
+                                    (double)histogram->buckets[i];
+            break;
+        }
+        seen += histogram->buckets[i];
+    }
+    return value < (double)histogram->max ? value : (double)histogram->max;
+}
+
+static void histogram_print(const struct gphoto_histogram *histogram, const char *name, struct dstr *text) {
+    dstr_catf(text, "%-9s %8llu  mean %8.2f  p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f ms\n", name,
+              (unsigned long long)histogram->count,
+              (double)histogram->total / (double)histogram->count / 1000000.0,
+              histogram_percentile(histogram, 50.0) / 1000000.0,
+              histogram_percentile(histogram, 90.0) / 1000000.0,
+              histogram_percentile(histogram, 99.0) / 1000000.0,
+              (double)histogram->max / 1000000.0);
+}
+
+void gphoto_stats_print(struct gphoto_stats *stats, struct dstr *text) {
+    struct gphoto_histogram snapshot;
+    size_t stage;
+
+    dstr_copy(text, "");
+    for (stage = 0; stage < GPHOTO_STAGE_COUNT; stage++) {
+        histogram_snapshot(&stats->stages[stage], &snapshot);
+        if (snapshot.count) {
+            histogram_print(&snapshot, stage_names[stage], text);
+        }
+    }
+    if (!text->len) {
+        dstr_copy(text, "No samples yet.\n");
+    }
+}
+
+/*
+ * Logs what was recorded since the last call, at most once per GPHOTO_STATS_LOG_INTERVAL. Meant to
+ * be called from one thread per source, the loop that drives it anyway.
+ */
+void gphoto_stats_log(struct gphoto_stats *stats, const char *name, uint64_t now) {
+    struct gphoto_histogram current, window;
+    struct dstr text = {0};
+    size_t stage, i;
+
+    if (now < stats->next_log) {
+        return;
+    }
+    stats->next_log = now + GPHOTO_STATS_LOG_INTERVAL;
+
+    for (stage = 0; stage < GPHOTO_STAGE_COUNT; stage++) {
+        histogram_snapshot(&stats->stages[stage], &current);
+        for (i = 0; i < GPHOTO_STATS_BUCKETS; i++) {
+            window.buckets[i] = current.buckets[i] - stats->logged[stage].buckets[i];
+        }
+        window.count = current.count - stats->logged[stage].count;
+        window.total = current.total - stats->logged[stage].total;
+        window.max = __atomic_exchange_n(&stats->stages[stage].window_max, 0, __ATOMIC_RELAXED);
+        stats->logged[stage] = current;
+
+        if (window.count) {
+            histogram_print(&window, stage_names[stage], &text);
+        }
+    }
+
+    if (text.len) {
+        blog(LOG_INFO, "%s timings over the last %llu s:\n%s", name,
+             (unsigned long long)(GPHOTO_STATS_LOG_INTERVAL / 1000000000ULL), text.array);
+    }
+    dstr_free(&text);
+}
+
+void gphoto_stats_update_settings(struct gphoto_stats *stats, obs_data_t *settings) {
+    struct dstr text = {0};
+
+    gphoto_stats_print(stats, &text);
+    obs_data_set_string(settings, "stats", text.array);
+    dstr_free(&text);
+}
+
+/* Read-only view of the histograms, the button refreshes it while the properties stay open. */
+void create_stats_property(obs_properties_t *props, obs_data_t *settings, struct gphoto_stats *stats,
+                           obs_property_clicked_t refresh) {
+    obs_property_t *text;
+
+    gphoto_stats_update_settings(stats, settings);
+    text = obs_properties_add_text(props, "stats", obs_module_text("Timings since start"), OBS_TEXT_MULTILINE);
+    obs_property_set_enabled(text, false);
+    obs_properties_add_button(props, "stats_refresh", obs_module_text("Refresh timings"), refresh);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <obs-module.h>
+#include <stdint.h>
+#include <util/dstr.h>
+
+/* Log2 buckets in microseconds: bucket 0 holds everything below 2 us, the last one everything above ~8 s. */
+#define GPHOTO_STATS_BUCKETS 24
+#define GPHOTO_STATS_LOG_INTERVAL 60000000000ULL
+
+enum gphoto_stage {
+    GPHOTO_STAGE_QUEUE_WAIT,
+    GPHOTO_STAGE_CAPTURE,
+    GPHOTO_STAGE_FETCH,
+    GPHOTO_STAGE_DECODE,
+    GPHOTO_STAGE_CONVERT,
+    GPHOTO_STAGE_OUTPUT,
+    GPHOTO_STAGE_COUNT,
+};
+
+struct gphoto_histogram {
+    uint64_t buckets[GPHOTO_STATS_BUCKETS];
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t window_max;
+};
+
+/*
+ * Timing histograms per pipeline stage of one source, durations in ns from os_gettime_ns. Recording
+ * is a few relaxed atomic adds, any thread can record without a lock and it stays on all the time.
+ * Readers see a snapshot that is consistent enough for display, not an exact one.
+ */
+struct gphoto_stats {
+    struct gphoto_histogram stages[GPHOTO_STAGE_COUNT];
+
+    /* Only touched by the thread calling gphoto_stats_log. */
+    struct gphoto_histogram logged[GPHOTO_STAGE_COUNT];
+    uint64_t next_log;
+};
+
+void gphoto_stats_reset(struct gphoto_stats *stats);
+void gphoto_stats_record(struct gphoto_stats *stats, enum gphoto_stage stage, uint64_t duration);
+void gphoto_stats_record_decode(struct gphoto_stats *stats, uint64_t start, uint64_t end, uint64_t convert_time);
+void gphoto_stats_print(struct gphoto_stats *stats, struct dstr *text);
+void gphoto_stats_log(struct gphoto_stats *stats, const char *name, uint64_t now);
+
+void gphoto_stats_update_settings(struct gphoto_stats *stats, obs_data_t *settings);
+void create_stats_property(obs_properties_t *props, obs_data_t *settings, struct gphoto_stats *stats,
+                           obs_property_clicked_t refresh);
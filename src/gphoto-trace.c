@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "gphoto-trace.h"
+
+#define TRACE_CHUNK_EVENTS 4096
+/* About a million spans per thread, later ones are counted and dropped. */
+#define TRACE_MAX_CHUNKS 256
+
+struct trace_event {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+};
+
+/* Written by the owning thread only, count and next are published with release stores. */
+struct trace_chunk {
+    struct trace_event events[TRACE_CHUNK_EVENTS];
+    size_t count;
+    struct trace_chunk *next;
+};
+
+struct trace_buffer {
+    struct trace_buffer *next;
+    const char *name;
+    long id;
+
+    struct trace_chunk *head;
+    struct trace_chunk *tail;
+    size_t chunks;
+    uint64_t dropped;
+};
+
+bool gphoto_tracing = false;
+
+static char *trace_path = NULL;
+static uint64_t trace_origin = 0;
+static struct trace_buffer *trace_buffers = NULL;
+static volatile long trace_thread_ids = 0;
+
+static __thread struct trace_buffer *thread_buffer = NULL;
+
+void gphoto_trace_init(void) {
+    const char *path = getenv("OBS_GPHOTO_TRACE");
+
+    if (path && *path) {
+        trace_path = bstrdup(path);
+        trace_origin = os_gettime_ns();
+        gphoto_tracing = true;
+        blog(LOG_INFO, "Tracing camera pipeline to %s.\n", trace_path);
+    }
+}
+
+/* Lock-free registration: a thread allocates its own buffer and pushes it on the global list once. */
+static struct trace_buffer *trace_thread_buffer(void) {
+    struct trace_buffer *buffer = thread_buffer;
+
+    if (!buffer) {
+        buffer = bzalloc(sizeof(struct trace_buffer));
+        buffer->id = os_atomic_inc_long(&trace_thread_ids);
+        buffer->head = buffer->tail = bzalloc(sizeof(struct trace_chunk));
+        buffer->chunks = 1;
+        buffer->next = __atomic_load_n(&trace_buffers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&trace_buffers, &buffer->next, buffer, true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+        thread_buffer = buffer;
+    }
+    return buffer;
+}
+
+void gphoto_trace_thread_name(const char *name) {
+    if (gphoto_tracing) {
+        __atomic_store_n(&trace_thread_buffer()->name, name, __ATOMIC_RELEASE);
+    }
+}
+
+uint64_t gphoto_trace_now(void) {
+    return gphoto_tracing ? os_gettime_ns() : 0;
+}
+
+void gphoto_trace_record(const char *name, uint64_t start, uint64_t end) {
+    struct trace_buffer *buffer = trace_thread_buffer();
+    struct trace_chunk *chunk = buffer->tail;
+    struct trace_event *event;
+
+    if (chunk->count == TRACE_CHUNK_EVENTS) {
+        if (buffer->chunks == TRACE_MAX_CHUNKS) {
+            buffer->dropped++;
+            return;
+        }
+        chunk = bzalloc(sizeof(struct trace_chunk));
+        __atomic_store_n(&buffer->tail->next, chunk, __ATOMIC_RELEASE);
+        buffer->tail = chunk;
+        buffer->chunks++;
+    }
+
+    event = &chunk->events[chunk->count];
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    __atomic_store_n(&chunk->count, chunk->count + 1, __ATOMIC_RELEASE);
+}
+
+/* Complete ("X") events in microseconds since module load, plus a name per thread. */
+static bool trace_write(const char *path) {
+    FILE *file = fopen(path, "w");
+    struct trace_buffer *buffer;
+    struct trace_chunk *chunk;
+    struct trace_event *event;
+    const char *name;
+    size_t i, count, events = 0;
+    int pid = (int)getpid();
+    bool first = true;
+
+    if (!file) {
+        return false;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (buffer = __atomic_load_n(&trace_buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next) {
+        name = __atomic_load_n(&buffer->name, __ATOMIC_ACQUIRE);
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,"
+                      "\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", pid, buffer->id, name ? name : "other");
+        first = false;
+
+        for (chunk = buffer->head; chunk; chunk = __atomic_load_n(&chunk->next, __ATOMIC_ACQUIRE)) {
+            count = __atomic_load_n(&chunk->count, __ATOMIC_ACQUIRE);
+            for (i = 0; i < count; i++) {
+                event = &chunk->events[i];
+                fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"gphoto\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,"
+                              "\"ts\":%.3f,\"dur\":%.3f}",
+                        event->name, pid, buffer->id, (double)(event->start - trace_origin) / 1000.0,
+                        (double)(event->end - event->start) / 1000.0);
+            }
+            events += count;
+        }
+        if (buffer->dropped) {
+            blog(LOG_WARNING, "Trace buffer of thread %s was full, %llu spans dropped.\n", name ? name : "other",
+                 (unsigned long long)buffer->dropped);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    blog(LOG_INFO, "Wrote %zu spans to %s.\n", events, path);
+    return true;
+}
+
+/* Called at module unload, when the sources and their threads are gone. */
+void gphoto_trace_free(void) {
+    struct trace_buffer *buffer, *next_buffer;
+    struct trace_chunk *chunk, *next_chunk;
+
+    if (!gphoto_tracing) {
+        return;
+    }
+    gphoto_tracing = false;
+
+    if (!trace_write(trace_path)) {
+        blog(LOG_WARNING, "Can't write trace to %s.\n", trace_path);
+    }
+
+    for (buffer = trace_buffers; buffer; buffer = next_buffer) {
+        next_buffer = buffer->next;
+        for (chunk = buffer->head; chunk; chunk = next_chunk) {
+            next_chunk = chunk->next;
+            bfree(chunk);
+        }
+        bfree(buffer);
+    }
+    trace_buffers = NULL;
+    thread_buffer = NULL;
+    bfree(trace_path);
+    trace_path = NULL;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Opt-in span tracing: with OBS_GPHOTO_TRACE=<file.json> set, spans from every thread are collected
+ * and written as Chrome trace-event JSON when the module unloads (chrome://tracing, Perfetto). Names
+ * must be string literals, they are stored as pointers. Disabled tracing costs one flag check.
+ */
+extern bool gphoto_tracing;
+
+void gphoto_trace_init(void);
+void gphoto_trace_free(void);
+
+void gphoto_trace_thread_name(const char *name);
+void gphoto_trace_record(const char *name, uint64_t start, uint64_t end);
+
+/* Start of a span, 0 while tracing is off so the matching gphoto_trace_span records nothing. */
+uint64_t gphoto_trace_now(void);
+
+static inline void gphoto_trace_span(const char *name, uint64_t start, uint64_t end) {
+    if (gphoto_tracing && start) {
+        gphoto_trace_record(name, start, end);
+    }
+}
+
+/* Closes a span opened with gphoto_trace_now. */
+static inline void gphoto_trace_end(const char *name, uint64_t start) {
+    if (gphoto_tracing && start) {
+        gphoto_trace_record(name, start, gphoto_trace_now());
+    }
+}
@@ -1,15 +1,22 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <obs-internal.h>
 #include <libudev.h>
 
+#include "gphoto-registry.h"
+#include "gphoto-trace.h"
+
 enum udev_action {
     UDEV_ACTION_ADDED,
     UDEV_ACTION_REMOVED,
     UDEV_ACTION_UNKNOWN
 };
 
+/* port is the libgphoto2 port path, usb:BUS,DEV, the same as in the autodetected camera list. */
 static const char *udev_signals[] = {
-        "void device_added(string device)",
-        "void device_removed(string device)",
+        "void device_added(string port, int vendor, int product, string devnode)",
+        "void device_removed(string port, int vendor, int product, string devnode)",
         NULL
 };
 
@@ -19,6 +26,8 @@ static pthread_mutex_t udev_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static pthread_t udev_thread;
 static os_event_t *udev_event;
+/* Written to on shutdown so the thread leaves select at once. */
+static int udev_wakeup[2] = {-1, -1};
 
 static signal_handler_t *udev_signalhandler = NULL;
 
@@ -35,11 +44,51 @@ static enum udev_action udev_action_to_enum(const char *action) {
     return UDEV_ACTION_UNKNOWN;
 }
 
+/*
+ * Only USB devices that can be cameras get through: libgphoto2's own udev rules tag them with
+ * ID_GPHOTO2, PTP cameras have a still image interface (class 6), the rest must have a driver that
+ * lists their id. The properties are there on remove too, udev replays them from its database.
+ */
+static bool udev_is_camera(struct udev_device *dev, int vendor, int product) {
+    const char *interfaces = udev_device_get_property_value(dev, "ID_USB_INTERFACES");
+
+    if (udev_device_get_property_value(dev, "ID_GPHOTO2")) {
+        return true;
+    }
+    if (interfaces && strstr(interfaces, ":06")) {
+        return true;
+    }
+    return vendor && gphoto_registry_known_usb(vendor, product);
+}
+
 static inline void udev_signal_event(struct udev_device *dev){
     enum udev_action action;
     struct calldata data;
+    const char *product_id = udev_device_get_property_value(dev, "PRODUCT");
+    const char *busnum = udev_device_get_property_value(dev, "BUSNUM");
+    const char *devnum = udev_device_get_property_value(dev, "DEVNUM");
+    const char *devnode = udev_device_get_devnode(dev);
+    unsigned int vendor = 0, product = 0;
+    char port[32];
 
     action = udev_action_to_enum(udev_device_get_action(dev));
+    if (action == UDEV_ACTION_UNKNOWN || !busnum || !devnum) {
+        return;
+    }
+    /* PRODUCT is vendor/product/bcdDevice in hex without leading zeros. */
+    if (product_id && sscanf(product_id, "%x/%x", &vendor, &product) != 2) {
+        vendor = product = 0;
+    }
+    if (!udev_is_camera(dev, (int)vendor, (int)product)) {
+        return;
+    }
+    snprintf(port, sizeof(port), "usb:%03d,%03d", atoi(busnum), atoi(devnum));
+
+    calldata_init(&data);
+    calldata_set_string(&data, "port", port);
+    calldata_set_int(&data, "vendor", vendor);
+    calldata_set_int(&data, "product", product);
+    calldata_set_string(&data, "devnode", devnode ? devnode : "");
 
     pthread_mutex_lock(&udev_mutex);
 
@@ -57,42 +106,48 @@ static inline void udev_signal_event(struct udev_device *dev){
     }
 
     pthread_mutex_unlock(&udev_mutex);
+    calldata_free(&data);
 }
 
 static void *udev_event_thread(void *vptr) {
     UNUSED_PARAMETER(vptr);
 
-    int fd;
+    int fd, max_fd;
     fd_set fds;
-    struct timeval tv;
     struct udev *udev;
     struct udev_monitor *mon;
     struct udev_device *dev;
+    uint64_t span;
+
+    gphoto_trace_thread_name("udev");
 
     /* set up udev monitoring */
     udev = udev_new();
     mon  = udev_monitor_new_from_netlink(udev, "udev");
-    udev_monitor_filter_add_match_subsystem_devtype(mon, "usb", NULL);
+    /* Whole devices only, their interfaces would signal the same plug again. */
+    udev_monitor_filter_add_match_subsystem_devtype(mon, "usb", "usb_device");
     if (udev_monitor_enable_receiving(mon) < 0)
         return NULL;
 
     /* set up fds */
     fd = udev_monitor_get_fd(mon);
+    max_fd = fd > udev_wakeup[0] ? fd : udev_wakeup[0];
 
     while (os_event_try(udev_event) == EAGAIN) {
         FD_ZERO(&fds);
         FD_SET(fd, &fds);
-        tv.tv_sec  = 1;
-        tv.tv_usec = 0;
+        FD_SET(udev_wakeup[0], &fds);
 
-        if (select(fd + 1, &fds, NULL, NULL, &tv) <= 0)
+        if (select(max_fd + 1, &fds, NULL, NULL, NULL) <= 0 || !FD_ISSET(fd, &fds))
             continue;
 
         dev = udev_monitor_receive_device(mon);
         if (!dev)
             continue;
 
+        span = gphoto_trace_now();
         udev_signal_event(dev);
+        gphoto_trace_end("udev event", span);
 
         udev_device_unref(dev);
     }
@@ -110,6 +165,8 @@ void gphoto_init_udev(void) {
     if (udev_refs == 0) {
         if (os_event_init(&udev_event, OS_EVENT_TYPE_MANUAL) != 0)
             goto fail;
+        if (pipe(udev_wakeup) != 0)
+            goto fail;
         if (pthread_create(&udev_thread, NULL, udev_event_thread, NULL) != 0)
             goto fail;
 
@@ -131,8 +188,13 @@ void gphoto_unref_udev(void) {
     /* unref udev monitor */
     if (udev_refs && --udev_refs == 0) {
         os_event_signal(udev_event);
+        if (write(udev_wakeup[1], "", 1) != 1)
+            blog(LOG_WARNING, "Can't wake up the udev thread.\n");
         pthread_join(udev_thread, NULL);
         os_event_destroy(udev_event);
+        close(udev_wakeup[0]);
+        close(udev_wakeup[1]);
+        udev_wakeup[0] = udev_wakeup[1] = -1;
 
         if (udev_signalhandler)
             signal_handler_destroy(udev_signalhandler);
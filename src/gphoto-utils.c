@@ -4,63 +4,12 @@
 #include <magick/MagickCore.h>
 
 #include "gphoto-preview.h"
+#include "gphoto-jpeg.h"
+#include "gphoto-convert.h"
+#include "gphoto-trace.h"
 
-static GPPortInfoList		*portinfolist = NULL;
-static CameraAbilitiesList *abilities = NULL;
-
-static int sample_open_camera (Camera ** camera, const char *model, const char *port, GPContext *context) {
-    //TODO: understand how this example from the repository works and, if necessary, rewrite it.
-    int		ret, m, p;
-    CameraAbilities	a;
-    GPPortInfo	pi;
-
-    ret = gp_camera_new (camera);
-    if (ret < GP_OK) return ret;
-
-    if (!abilities) {
-        /* Load all the camera drivers we have... */
-        ret = gp_abilities_list_new (&abilities);
-        if (ret < GP_OK) return ret;
-        ret = gp_abilities_list_load (abilities, context);
-        if (ret < GP_OK) return ret;
-    }
-
-    /* First lookup the model / driver */
-    m = gp_abilities_list_lookup_model (abilities, model);
-    if (m < GP_OK) return ret;
-    ret = gp_abilities_list_get_abilities (abilities, m, &a);
-    if (ret < GP_OK) return ret;
-    ret = gp_camera_set_abilities (*camera, a);
-    if (ret < GP_OK) return ret;
-
-    if (!portinfolist) {
-        /* Load all the port drivers we have... */
-        ret = gp_port_info_list_new (&portinfolist);
-        if (ret < GP_OK) return ret;
-        ret = gp_port_info_list_load (portinfolist);
-        if (ret < 0) return ret;
-        ret = gp_port_info_list_count (portinfolist);
-        if (ret < 0) return ret;
-    }
-
-    /* Then associate the camera with the specified port */
-    p = gp_port_info_list_lookup_path (portinfolist, port);
-    switch (p) {
-        case GP_ERROR_UNKNOWN_PORT:
-            break;
-        default:
-            break;
-    }
-    if (p < GP_OK) return p;
-
-    ret = gp_port_info_list_get_info (portinfolist, p, &pi);
-    if (ret < GP_OK) return ret;
-    ret = gp_camera_set_port_info (*camera, pi);
-    if (ret < GP_OK) return ret;
-    return GP_OK;
-}
-
-int gp_camera_by_name(Camera **camera, const char *name, CameraList *cam_list, GPContext *context) {
+int gphoto_camera_by_name(struct gphoto_camera **camera, const char *name, CameraList *cam_list,
+                          GPContext *context) {
     int i, count, ret;
     const char *camera_name, *usb_port;
 
@@ -69,7 +18,7 @@ int gp_camera_by_name(Camera **camera, const char *name, CameraList *cam_list, G
         gp_list_get_name(cam_list, i, &camera_name);
         gp_list_get_value(cam_list, i, &usb_port);
         if (strcmp(camera_name, name) == 0) {
-            ret = sample_open_camera(camera, camera_name, usb_port, context);
+            ret = gphoto_camera_open(camera, camera_name, usb_port, context);
             return ret;
         }
     }
@@ -90,44 +39,63 @@ void property_cam_list(CameraList *cam_list, obs_property_t *prop) {
     }
 }
 
-void gphoto_capture_preview(Camera *camera, GPContext *context, int width, int height, uint8_t *texture_data){
-    CameraFile *cam_file = NULL;
-    const char *image_data = NULL;
-    unsigned long data_size = NULL;
-    Image *image = NULL;
-    ImageInfo *image_info = AcquireImageInfo();
-    ExceptionInfo *exception = AcquireExceptionInfo();
+/*
+ * ImageMagick exports straight into the frame as BGR plus a zero pad byte, the alpha fill kernel makes it opaque.
+ * A padded row is exported on its own.
+ */
+static bool magick_export_bgra(Image *image, uint32_t width, uint32_t height, uint8_t *out, uint32_t linesize,
+                               ExceptionInfo *exception, uint64_t *convert_time){
+    uint64_t start;
+    uint32_t y;
+
+    if (linesize == width * 4) {
+        ExportImagePixels(image, 0, 0, width, height, "BGRP", CharPixel, out, exception);
+    } else {
+        for (y = 0; y < height && exception->severity == UndefinedException; y++) {
+            ExportImagePixels(image, 0, y, width, 1, "BGRP", CharPixel, out + (size_t)y * linesize, exception);
+        }
+    }
+    if (exception->severity != UndefinedException) {
+        CatchException(exception);
+        blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *)exception->severity);
+        exception->severity = UndefinedException;
+        return false;
+    }
 
-    if (gp_file_new(&cam_file) < GP_OK){
-        blog(LOG_WARNING, "What???\n");
-    }else {
-        if (gp_camera_capture_preview(camera, cam_file, context) < GP_OK) {
-            blog(LOG_DEBUG, "Can't capture preview.\n");
-        } else {
-            if (gp_file_get_data_and_size(cam_file, &image_data, &data_size) < GP_OK) {
-                blog(LOG_WARNING, "Can't get image data.\n");
-            } else {
-                image = BlobToImage(image_info, image_data, data_size, exception);
-                if (exception->severity != UndefinedException) {
-                    CatchException(exception);
-                    blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *)exception->severity);
-                    exception->severity = UndefinedException;
-                } else {
-                    ExportImagePixels(image, 0, 0, (const size_t)width, (const size_t)height, "BGRA", CharPixel, texture_data,
-                                      exception);
-                    if (exception->severity != UndefinedException) {
-                        CatchException(exception);
-                        blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *)exception->severity);
-                        exception->severity = UndefinedException;
-                    }
-                }
-            }
+    start = os_gettime_ns();
+    if (linesize == width * 4) {
+        gphoto_convert->fill_alpha(out, (size_t)width * height);
+    } else {
+        for (y = 0; y < height; y++) {
+            gphoto_convert->fill_alpha(out + (size_t)y * linesize, width);
         }
     }
+    *convert_time = os_gettime_ns() - start;
+    return true;
+}
+
+/* An image bigger than width x height is box filtered down to it, e.g. a still shown smaller than shot. */
+static bool magick_decode_bgra(const uint8_t *image_data, size_t data_size, uint32_t width, uint32_t height,
+                               uint8_t *out, uint32_t linesize, uint64_t *convert_time){
+    Image *image = NULL, *scaled;
+    ImageInfo *image_info = AcquireImageInfo();
+    ExceptionInfo *exception = AcquireExceptionInfo();
+    bool ret = false;
 
-    if(image_data){
-        free(image_data);
+    image = BlobToImage(image_info, image_data, data_size, exception);
+    if (exception->severity == UndefinedException && image && (image->columns != width || image->rows != height)) {
+        scaled = ScaleImage(image, width, height, exception);
+        DestroyImageList(image);
+        image = scaled;
     }
+    if (exception->severity != UndefinedException) {
+        CatchException(exception);
+        blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *)exception->severity);
+        exception->severity = UndefinedException;
+    } else {
+        ret = magick_export_bgra(image, width, height, out, linesize, exception, convert_time);
+    }
+
     if(image_info){
         DestroyImageInfo(image_info);
     }
@@ -137,56 +105,58 @@ void gphoto_capture_preview(Camera *camera, GPContext *context, int width, int h
     if(exception){
         DestroyExceptionInfo(exception);
     }
-    if(cam_file){
-        //TODO: SIGSEGV here, can't understand why!
-        //gp_file_free(cam_file);
+    return ret;
+}
+
+/* convert_time gets the part of the decode spent converting colours or planes as a separate pass. */
+bool gphoto_decode_preview(struct gphoto_jpeg_decoder *decoder, const uint8_t *image_data, size_t data_size,
+                           uint32_t scale, struct obs_source_frame *frame, uint64_t *convert_time){
+    bool ret = false;
+
+    *convert_time = 0;
+    if (gphoto_jpeg_is_jpeg(image_data, data_size)) {
+        if (!gphoto_jpeg_is_complete(image_data, data_size)) {
+            blog(LOG_DEBUG, "Truncated preview frame, skipped.\n");
+        } else if (frame->format == VIDEO_FORMAT_I420) {
+            ret = gphoto_jpeg_decode_i420(decoder, image_data, data_size, scale, frame->width, frame->height,
+                                          frame->data, frame->linesize);
+        } else {
+            ret = gphoto_jpeg_decode_bgra(decoder, image_data, data_size, scale, frame->width, frame->height,
+                                          frame->data[0], frame->linesize[0]);
+        }
+        *convert_time = gphoto_jpeg_decoder_convert_time(decoder);
+    } else if (frame->format != VIDEO_FORMAT_BGRX) {
+        blog(LOG_DEBUG, "Non JPEG preview frame can't be output as YUV, skipped.\n");
+    } else {
+        ret = magick_decode_bgra(image_data, data_size, frame->width, frame->height, frame->data[0],
+                                 frame->linesize[0], convert_time);
     }
+    return ret;
 }
 
-void gphoto_capture(Camera *camera, GPContext *context, int width, int height, uint8_t *texture_data){
-    CameraFile *cam_file = NULL;
-    CameraFilePath camera_file_path;
-    const char *image_data = NULL;
-    unsigned long data_size = NULL;
+bool gphoto_image_size(const uint8_t *image_data, size_t data_size, uint32_t *width, uint32_t *height){
     Image *image = NULL;
-    ImageInfo *image_info = AcquireImageInfo();
-    ExceptionInfo *exception = AcquireExceptionInfo();
+    ImageInfo *image_info = NULL;
+    ExceptionInfo *exception = NULL;
+    bool ret = false;
 
-    if (gp_file_new(&cam_file) < GP_OK){
-        blog(LOG_WARNING, "What???\n");
-    }else {
-        if (gp_camera_capture(camera, GP_CAPTURE_IMAGE, &camera_file_path, context) < GP_OK) {
-            blog(LOG_WARNING, "Can't capture photo.\n");
-        } else {
-            if (gp_camera_file_get(camera, camera_file_path.folder, camera_file_path.name,
-                                   GP_FILE_TYPE_NORMAL, cam_file, context) < GP_OK) {
-                blog(LOG_WARNING, "Can't get photo from camera.\n");
-            } else {
-                if (gp_file_get_data_and_size(cam_file, &image_data, &data_size) < GP_OK) {
-                    blog(LOG_WARNING, "Can't get image data.\n");
-                } else {
-                    gp_camera_file_delete(camera, camera_file_path.folder, camera_file_path.name, context);
-                    image = BlobToImage(image_info, image_data, data_size, exception);
-                    if (exception->severity != UndefinedException) {
-                        CatchException(exception);
-                        blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *) exception->severity);
-                        exception->severity = UndefinedException;
-                    } else {
-                        ExportImagePixels(image, 0, 0, (const size_t)width, (const size_t)height, "BGRA", CharPixel, texture_data, exception);
-                        if (exception->severity != UndefinedException) {
-                            CatchException(exception);
-                            blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *) exception->severity);
-                            exception->severity = UndefinedException;
-                        }
-                    }
-                }
-            }
-        }
+    if (gphoto_jpeg_read_size(image_data, data_size, width, height)) {
+        return true;
     }
 
-    if(image_data){
-        free(image_data);
+    image_info = AcquireImageInfo();
+    exception = AcquireExceptionInfo();
+    image = PingBlob(image_info, image_data, data_size, exception);
+    if (exception->severity != UndefinedException) {
+        CatchException(exception);
+        blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *)exception->severity);
+        exception->severity = UndefinedException;
+    } else {
+        *width = (uint32_t)image->magick_columns;
+        *height = (uint32_t)image->magick_rows;
+        ret = true;
     }
+
     if(image_info){
         DestroyImageInfo(image_info);
     }
@@ -196,34 +166,107 @@ void gphoto_capture(Camera *camera, GPContext *context, int width, int height, u
     if(exception){
         DestroyExceptionInfo(exception);
     }
-    if(cam_file){
-        //TODO: SIGSEGV here, can't understand why!
-        //gp_file_free(cam_file);
+    return ret;
+}
+
+/* width and height are the photo size scaled down by scale, JPEG scales in the DCT and the rest after decoding. */
+bool gphoto_decode_still(struct gphoto_jpeg_decoder *decoder, const uint8_t *image_data, size_t data_size,
+                         uint32_t scale, uint32_t width, uint32_t height, uint8_t *texture_data,
+                         uint64_t *convert_time){
+    bool ret;
+
+    *convert_time = 0;
+    if (gphoto_jpeg_is_jpeg(image_data, data_size)) {
+        ret = gphoto_jpeg_decode_bgra(decoder, image_data, data_size, scale, width, height, texture_data, width * 4);
+        *convert_time = gphoto_jpeg_decoder_convert_time(decoder);
+        return ret;
+    }
+    return magick_decode_bgra(image_data, data_size, width, height, texture_data, width * 4, convert_time);
+}
+
+
+/* Shoots a photo and downloads it into cam_file, decoding is up to the caller which knows the frame size. */
+bool gphoto_capture(struct gphoto_camera *camera, GPContext *context, CameraFile *cam_file,
+                    struct gphoto_stats *stats){
+    CameraFilePath camera_file_path;
+    const char *image_data = NULL;
+    unsigned long data_size = 0;
+    uint64_t start, end;
+    bool ret = false;
+
+    start = os_gettime_ns();
+    if (gphoto_camera_capture(camera, GP_CAPTURE_IMAGE, &camera_file_path, context) < GP_OK) {
+        blog(LOG_WARNING, "Can't capture photo.\n");
+    } else {
+        /* The shutter is its own stage, the fetch is the download like a polled photo's. */
+        end = os_gettime_ns();
+        gphoto_stats_record(stats, GPHOTO_STAGE_CAPTURE, end - start);
+        gphoto_trace_span("capture", start, end);
+        start = end;
+        if (gphoto_camera_file_get(camera, camera_file_path.folder, camera_file_path.name,
+                                   GP_FILE_TYPE_NORMAL, cam_file, context) < GP_OK) {
+            blog(LOG_WARNING, "Can't get photo from camera.\n");
+        } else {
+            if (gp_file_get_data_and_size(cam_file, &image_data, &data_size) < GP_OK) {
+                blog(LOG_WARNING, "Can't get image data.\n");
+            } else {
+                gphoto_camera_file_delete(camera, camera_file_path.folder, camera_file_path.name, context);
+                end = os_gettime_ns();
+                gphoto_stats_record(stats, GPHOTO_STAGE_FETCH, end - start);
+                gphoto_trace_span("download", start, end);
+                ret = true;
+            }
+        }
+    }
+    return ret;
+}
+
+/* Current value of a text or choice config as a bstrdup'd string, NULL if the camera doesn't have it. */
+char *gphoto_camera_config_string(struct gphoto_camera *camera, const char *name, GPContext *context){
+    CameraWidget *widget = NULL;
+    CameraWidgetType type;
+    const char *value = NULL;
+    char *ret = NULL;
+
+    if (gphoto_camera_get_single_config(camera, name, &widget, context) == GP_OK &&
+        gp_widget_get_type(widget, &type) == GP_OK &&
+        (type == GP_WIDGET_TEXT || type == GP_WIDGET_RADIO || type == GP_WIDGET_MENU) &&
+        gp_widget_get_value(widget, &value) == GP_OK && value) {
+        ret = bstrdup(value);
+    }
+    if (widget) {
+        gp_widget_free(widget);
     }
+    return ret;
 }
 
 int gphoto_cam_list(CameraList *cam_list, GPContext *context){
     int ret;
+    uint64_t span = gphoto_trace_now();
     gp_list_reset(cam_list);
-    ret = gp_camera_autodetect(cam_list, context);
+    ret = gphoto_camera_autodetect(cam_list, context);
+    gphoto_trace_end("autodetect", span);
     return ret;
 }
 
-int cancel_autofocus(Camera *camera, GPContext *context){
+/* Toggle widgets hold an int, a bool would only fill part of it. */
+int cancel_autofocus(struct gphoto_camera *camera, GPContext *context){
     int ret = -1;
     CameraWidget *widget = NULL;
-    bool toggle;
+    int toggle;
 
-    if (gp_camera_get_single_config(camera, "autofocusdrive", &widget, context) == GP_OK) {
+    if (gphoto_camera_get_single_config(camera, "autofocusdrive", &widget, context) == GP_OK) {
         toggle = FALSE;
         gp_widget_set_value(widget, &toggle);
-        ret = gp_camera_set_single_config(camera, "autofocusdrive", widget, context);
+        ret = gphoto_camera_set_single_config(camera, "autofocusdrive", widget, context);
+        gp_widget_free(widget);
+        widget = NULL;
     }
 
-    if (gp_camera_get_single_config(camera, "cancelautofocus", &widget, context) == GP_OK) {
+    if (gphoto_camera_get_single_config(camera, "cancelautofocus", &widget, context) == GP_OK) {
         toggle = TRUE;
         gp_widget_set_value(widget, &toggle);
-        gp_camera_set_single_config(camera, "cancelautofocus", widget, context);
+        gphoto_camera_set_single_config(camera, "cancelautofocus", widget, context);
     }
 
     if (widget) {
@@ -232,16 +275,26 @@ int cancel_autofocus(Camera *camera, GPContext *context){
     return ret;
 }
 
-obs_property_t *camera_config_to_obs_property(char *config_name, Camera *camera, GPContext *context, obs_properties_t *props,
-                                              const char *prop_name, const char *prop_description) {
+/* A config in a tree from gphoto_camera_get_config, NULL without a tree or if the camera has no such config. */
+CameraWidget *gphoto_config_find(CameraWidget *config, const char *name) {
     CameraWidget *widget = NULL;
+
+    if (!config || gp_widget_get_child_by_name(config, name, &widget) < GP_OK) {
+        return NULL;
+    }
+    return widget;
+}
+
+obs_property_t *camera_config_to_obs_property(CameraWidget *config, const char *config_name, obs_properties_t *props,
+                                              const char *prop_name, const char *prop_description) {
+    CameraWidget *widget = gphoto_config_find(config, config_name);
     CameraWidgetType type;
     obs_property_t *p = NULL;
     int i, count;
     float min, max, step;
     const char *choose_val;
-    if (gp_camera_get_single_config(camera, config_name, &widget, context) < GP_OK) {
-        blog(LOG_WARNING, "Can't get single config %s for camera.\n", config_name);
+    if (!widget) {
+        blog(LOG_WARNING, "Can't get config %s for camera.\n", config_name);
     } else {
         if (gp_widget_get_type(widget, &type) < GP_OK) {
             blog(LOG_WARNING, "Can't get type for config %s.\n", config_name);
@@ -250,16 +303,16 @@ obs_property_t *camera_config_to_obs_property(char *config_name, Camera *camera,
                 case GP_WIDGET_TEXT:
                     p = obs_properties_add_text(props, prop_name, obs_module_text(prop_description),
                                                 OBS_TEXT_DEFAULT);
-                    goto out;
+                    break;
                 case GP_WIDGET_RANGE:
                     if(gp_widget_get_range(widget, &min, &max, &step) == GP_OK) {
                         p = obs_properties_add_float_slider(props, prop_name, obs_module_text(prop_description),
                                                             min, max, step);
                     }
-                    goto out;
+                    break;
                 case GP_WIDGET_TOGGLE:
                     p = obs_properties_add_bool(props, prop_name, obs_module_text(prop_description));
-                    goto out;
+                    break;
                 case GP_WIDGET_RADIO:
                 case GP_WIDGET_MENU:
                     p = obs_properties_add_list(props, prop_name, obs_module_text(prop_description),
@@ -270,16 +323,12 @@ obs_property_t *camera_config_to_obs_property(char *config_name, Camera *camera,
                             obs_property_list_add_string(p, choose_val, choose_val);
                         }
                     }
-                    goto out;
+                    break;
                 default:
-                    goto out;
+                    break;
             }
         }
     }
-    out:
-    if(widget){
-        gp_widget_free(widget);
-    }
     return p;
 }
 
@@ -290,104 +339,91 @@ static bool obs_property_calback(obs_properties_t *props, obs_property_t *prop,
     return true;
 }
 
+/* Built from the cached config tree, the camera isn't asked. */
 int create_obs_property_from_camera_config(obs_properties_t *props, obs_data_t *settings, const char *prop_description,
-                                           Camera *camera, GPContext *context, char *config_name){
+                                           CameraWidget *config, char *config_name){
     int ret = -1;
     char *text;
     float range;
-    bool toggle;
+    int toggle;
     char *radio;
     obs_property_t *p;
-    CameraWidget *widget = NULL;
-    p = camera_config_to_obs_property(config_name, camera, context, props, config_name, prop_description);
+    CameraWidget *widget = gphoto_config_find(config, config_name);
+    p = camera_config_to_obs_property(config, config_name, props, config_name, prop_description);
     obs_property_set_modified_callback(p, obs_property_calback);
+    if (!widget) {
+        return ret;
+    }
     enum obs_property_type p_type = obs_property_get_type(p);
     switch (p_type){
         case OBS_PROPERTY_TEXT:
-            ret = gp_camera_get_single_config(camera, config_name, &widget, context);
+            ret = gp_widget_get_value(widget, &text);
             if(ret == GP_OK){
-                gp_widget_get_value(widget, &text);
                 obs_data_set_default_string(settings, config_name, text);
             }
-            goto out;
+            break;
         case OBS_PROPERTY_FLOAT:
-            ret = gp_camera_get_single_config(camera, config_name, &widget, context);
+            ret = gp_widget_get_value(widget, &range);
             if(ret == GP_OK){
-                gp_widget_get_value(widget, &range);
                 obs_data_set_default_double(settings, config_name, range);
             }
-            goto out;
+            break;
         case OBS_PROPERTY_BOOL:
-            ret = gp_camera_get_single_config(camera, config_name, &widget, context);
+            ret = gp_widget_get_value(widget, &toggle);
             if(ret == GP_OK){
-                gp_widget_get_value(widget, &toggle);
-                obs_data_set_default_bool(settings, config_name, toggle);
+                obs_data_set_default_bool(settings, config_name, toggle != 0);
             }
-            goto out;
+            break;
         case OBS_PROPERTY_LIST:
-            ret = gp_camera_get_single_config(camera, config_name, &widget, context);
+            ret = gp_widget_get_value(widget, &radio);
             if(ret == GP_OK){
-                gp_widget_get_value(widget, &radio);
                 obs_data_set_default_string(settings, config_name, radio);
             }
-            goto out;
+            break;
         default:
-            goto out;
-
-    }
-    out:
-    if(widget){
-        gp_widget_free(widget);
+            break;
     }
     return ret;
 }
 
-int set_camera_config(obs_data_t *settings, Camera *camera, GPContext *context){
-    int ret = -1;
-    const char *text;
-    double range;
-    bool toggle;
-    CameraWidget *widget = NULL;
+/*
+ * Sets a widget of the cached tree to the value of name in settings. False if it already has that
+ * value, then there is nothing to write.
+ */
+bool gphoto_config_assign(CameraWidget *widget, obs_data_t *settings, const char *name){
     CameraWidgetType type;
-    const char *name = obs_data_get_string(settings, "auto_prop");
-
-    cancel_autofocus(camera, context);
-
-    if (gp_camera_get_single_config(camera, name, &widget, context) < GP_OK) {
-        blog(LOG_WARNING, "Can't get single config %s for camera.\n", name);
-    } else {
-        if (gp_widget_get_type(widget, &type) < GP_OK) {
-            blog(LOG_WARNING, "Can't get type for config %s.\n", name);
-        } else {
-            switch (type) {
-                case GP_WIDGET_TEXT:
-                    text = obs_data_get_string(settings, name);
-                    ret = gp_widget_set_value(widget, text);
-                    goto out;
-                case GP_WIDGET_RANGE:
-                    range = obs_data_get_double(settings, name);
-                    ret = gp_widget_set_value(widget, &range); //It's right?
-                    goto out;
-                case GP_WIDGET_TOGGLE:
-                    toggle = obs_data_get_bool(settings, name);
-                    ret = gp_widget_set_value(widget, &toggle);
-                    goto out;
-                case GP_WIDGET_RADIO:
-                case GP_WIDGET_MENU:
-                    text = obs_data_get_string(settings, name);
-                    ret = gp_widget_set_value(widget, text);
-                    goto out;
-                default:
-                    goto out;
+    const char *text, *current = NULL;
+    float range, current_range;
+    int toggle, current_toggle;
+
+    if (gp_widget_get_type(widget, &type) < GP_OK) {
+        blog(LOG_WARNING, "Can't get type for config %s.\n", name);
+        return false;
+    }
+    switch (type) {
+        case GP_WIDGET_TEXT:
+        case GP_WIDGET_RADIO:
+        case GP_WIDGET_MENU:
+            text = obs_data_get_string(settings, name);
+            if (gp_widget_get_value(widget, &current) == GP_OK && current && strcmp(current, text) == 0) {
+                return false;
             }
-        }
-    }
-    out:
-    if(widget){
-        ret = gp_camera_set_single_config(camera, name, widget, context);
-        gp_widget_free(widget);
+            return gp_widget_set_value(widget, text) == GP_OK;
+        case GP_WIDGET_RANGE:
+            range = (float)obs_data_get_double(settings, name);
+            if (gp_widget_get_value(widget, &current_range) == GP_OK && current_range == range) {
+                return false;
+            }
+            return gp_widget_set_value(widget, &range) == GP_OK;
+        case GP_WIDGET_TOGGLE:
+            toggle = obs_data_get_bool(settings, name);
+            if (gp_widget_get_value(widget, &current_toggle) == GP_OK && (current_toggle != 0) == toggle) {
+                return false;
+            }
+            return gp_widget_set_value(widget, &toggle) == GP_OK;
+        default:
+            return false;
     }
-    return ret;
 }
 
 static bool autofocus_property_calback(obs_properties_t *props, obs_property_t *prop, obs_data_t *settings){
@@ -413,15 +449,14 @@ static bool autofocus_property_calback(obs_properties_t *props, obs_property_t *
     return true;
 }
 
-int create_autofocus_property(obs_properties_t *props, obs_data_t *settings, Camera *camera, GPContext *context) {
+int create_autofocus_property(obs_properties_t *props, obs_data_t *settings, CameraWidget *config) {
     int ret = -1;
-    bool toggle;
-    CameraWidget *widget = NULL;
+    CameraWidget *widget = gphoto_config_find(config, "autofocusdrive");
     CameraWidgetType type;
     obs_property_t *p;
 
-    if (gp_camera_get_single_config(camera, "autofocusdrive", &widget, context) < GP_OK) {
-        blog(LOG_WARNING, "Can't get single config autofocusdrive for camera.\n");
+    if (!widget) {
+        blog(LOG_WARNING, "Can't get config autofocusdrive for camera.\n");
     } else {
         if (gp_widget_get_type(widget, &type) < GP_OK) {
             blog(LOG_WARNING, "Can't get type for config autofocusdrive.\n");
@@ -429,26 +464,23 @@ int create_autofocus_property(obs_properties_t *props, obs_data_t *settings, Cam
             if (type == GP_WIDGET_TOGGLE) {
                 p = obs_properties_add_bool(props, "autofocusdrive", obs_module_text("Auto Focus"));
                 obs_property_set_modified_callback(p, autofocus_property_calback);
-                gp_widget_get_value(widget, &toggle);
                 obs_data_set_default_bool(settings, "autofocusdrive", FALSE);
+                ret = GP_OK;
             }
         }
     }
-    if (widget) {
-        gp_widget_free(widget);
-    }
     return ret;
 }
 
-int set_autofocus(Camera *camera, GPContext *context){
+int set_autofocus(struct gphoto_camera *camera, GPContext *context){
     int ret = -1;
     CameraWidget *widget = NULL;
     CameraWidgetType type;
-    bool toggle;
+    int toggle = TRUE;
 
     cancel_autofocus(camera, context);
 
-    if (gp_camera_get_single_config(camera, "autofocusdrive", &widget, context) < GP_OK) {
+    if (gphoto_camera_get_single_config(camera, "autofocusdrive", &widget, context) < GP_OK) {
         blog(LOG_WARNING, "Can't get single config autofocusdrive for camera.\n");
     } else {
         if (gp_widget_get_type(widget, &type) < GP_OK) {
@@ -456,8 +488,7 @@ int set_autofocus(Camera *camera, GPContext *context){
         } else {
             if (type == GP_WIDGET_TOGGLE) {
                 gp_widget_set_value(widget, &toggle);
-                ret = gp_camera_set_single_config(camera, "autofocusdrive", widget, context);
-                return ret;
+                ret = gphoto_camera_set_single_config(camera, "autofocusdrive", widget, context);
             }
         }
     }
@@ -467,14 +498,14 @@ int set_autofocus(Camera *camera, GPContext *context){
     return ret;
 }
 
-int set_manualfocus(const char *value, Camera *camera, GPContext *context){
+int set_manualfocus(const char *value, struct gphoto_camera *camera, GPContext *context){
     int ret = -1;
     CameraWidget *widget = NULL;
     CameraWidgetType type;
 
     cancel_autofocus(camera, context);
 
-    if (gp_camera_get_single_config(camera, "manualfocusdrive", &widget, context) < GP_OK) {
+    if (gphoto_camera_get_single_config(camera, "manualfocusdrive", &widget, context) < GP_OK) {
         blog(LOG_WARNING, "Can't get single config manualfocusdrive for camera.\n");
     } else {
         if (gp_widget_get_type(widget, &type) < GP_OK) {
@@ -486,41 +517,31 @@ int set_manualfocus(const char *value, Camera *camera, GPContext *context){
         }
     }
     if(widget){
-        ret = gp_camera_set_single_config(camera, "manualfocusdrive", widget, context);
+        ret = gphoto_camera_set_single_config(camera, "manualfocusdrive", widget, context);
         gp_widget_free(widget);
     }
     return ret;
 }
 
-static bool manual_radio_focus_callback(obs_properties_t *props, obs_property_t *prop, void *vptr){
-    UNUSED_PARAMETER(props);
-    struct preview_data *data = vptr;
-    const char *value = obs_property_name(prop);
-    pthread_mutex_lock(&data->camera_mutex);
-    set_manualfocus(value, data->camera, data->gp_context);
-    pthread_mutex_unlock(&data->camera_mutex);
-
-    return TRUE;
-}
-
-int create_manualfocus_property(obs_properties_t *props, obs_data_t *settings, Camera *camera, GPContext *context){
+int create_manualfocus_property(obs_properties_t *props, obs_data_t *settings, CameraWidget *config,
+                                obs_property_clicked_t clicked){
     int ret = -1, count ;
     float min, max, step, range;
-    CameraWidget *widget = NULL;
+    CameraWidget *widget = gphoto_config_find(config, "manualfocusdrive");
     CameraWidgetType type;
     obs_property_t *p;
-    if(gp_camera_get_single_config(camera, "manualfocusdrive", &widget, context) == GP_OK){
+    if(widget){
         if(gp_widget_get_type(widget, &type) == GP_OK) {
             if (type == GP_WIDGET_RADIO) {
                 count = gp_widget_count_choices(widget);
                 //TODO: remove indian code. If loop can't Set btn name and text.
                 if (count == 7){
-                    obs_properties_add_button(props, "Near 3", "<<<", manual_radio_focus_callback);
-                    obs_properties_add_button(props, "Near 2", "<<", manual_radio_focus_callback);
-                    obs_properties_add_button(props, "Near 1", "<", manual_radio_focus_callback);
-                    obs_properties_add_button(props, "Far 1", ">", manual_radio_focus_callback);
-                    obs_properties_add_button(props, "Far 2", ">>", manual_radio_focus_callback);
-                    obs_properties_add_button(props, "Far 3", ">>>", manual_radio_focus_callback);
+                    obs_properties_add_button(props, "Near 3", "<<<", clicked);
+                    obs_properties_add_button(props, "Near 2", "<<", clicked);
+                    obs_properties_add_button(props, "Near 1", "<", clicked);
+                    obs_properties_add_button(props, "Far 1", ">", clicked);
+                    obs_properties_add_button(props, "Far 2", ">>", clicked);
+                    obs_properties_add_button(props, "Far 3", ">>>", clicked);
                 }
             } else {
                 if (type == GP_WIDGET_RANGE) {
@@ -535,8 +556,5 @@ int create_manualfocus_property(obs_properties_t *props, obs_data_t *settings, C
             }
         }
     }
-    if(widget){
-        gp_widget_free(widget);
-    }
     return ret;
-}
\ No newline at end of file
+}
@@ -1,23 +1,39 @@
+#pragma once
+
 #include <obs-module.h>
 #include <obs-internal.h>
 #include <gphoto2/gphoto2-camera.h>
 
-int gp_camera_by_name(Camera **camera, const char *name, CameraList *cam_list, GPContext *context);
+#include "gphoto-backend.h"
+#include "gphoto-jpeg.h"
+#include "gphoto-stats.h"
+
+int gphoto_camera_by_name(struct gphoto_camera **camera, const char *name, CameraList *cam_list,
+                          GPContext *context);
 void property_cam_list(CameraList *cam_list, obs_property_t *prop);
-void gphoto_capture_preview(Camera *camera, GPContext *context, int width, int height, uint8_t *texture_data);
-void gphoto_capture(Camera *camera, GPContext *context, int width, int height, uint8_t *texture_data);
+bool gphoto_decode_preview(struct gphoto_jpeg_decoder *decoder, const uint8_t *image_data, size_t data_size,
+                           uint32_t scale, struct obs_source_frame *frame, uint64_t *convert_time);
+bool gphoto_image_size(const uint8_t *image_data, size_t data_size, uint32_t *width, uint32_t *height);
+bool gphoto_decode_still(struct gphoto_jpeg_decoder *decoder, const uint8_t *image_data, size_t data_size,
+                         uint32_t scale, uint32_t width, uint32_t height, uint8_t *texture_data,
+                         uint64_t *convert_time);
+bool gphoto_capture(struct gphoto_camera *camera, GPContext *context, CameraFile *cam_file,
+                    struct gphoto_stats *stats);
+char *gphoto_camera_config_string(struct gphoto_camera *camera, const char *name, GPContext *context);
 int gphoto_cam_list(CameraList *cam_list, GPContext *context);
 
-int cancel_autofocus(Camera *camera, GPContext *context);
+int cancel_autofocus(struct gphoto_camera *camera, GPContext *context);
 
-obs_property_t *camera_config_to_obs_property(char *config_name, Camera *camera, GPContext *context, obs_properties_t *props,
+CameraWidget *gphoto_config_find(CameraWidget *config, const char *name);
+obs_property_t *camera_config_to_obs_property(CameraWidget *config, const char *config_name, obs_properties_t *props,
                                               const char *prop_name, const char *prop_description);
 int create_obs_property_from_camera_config(obs_properties_t *props, obs_data_t *settings, const char *prop_description,
-                                           Camera *camera, GPContext *context, char *config_name);
-int set_camera_config(obs_data_t *settings, Camera *camera, GPContext *context);
+                                           CameraWidget *config, char *config_name);
+bool gphoto_config_assign(CameraWidget *widget, obs_data_t *settings, const char *name);
 
-int create_autofocus_property(obs_properties_t *props, obs_data_t *settings, Camera *camera, GPContext *context);
-int set_autofocus(Camera *camera, GPContext *context);
+int create_autofocus_property(obs_properties_t *props, obs_data_t *settings, CameraWidget *config);
+int set_autofocus(struct gphoto_camera *camera, GPContext *context);
 
-int create_manualfocus_property(obs_properties_t *props, obs_data_t *settings, Camera *camera, GPContext *context);
-int set_manualfocus(const char *value, Camera *camera, GPContext *context);
\ No newline at end of file
+int create_manualfocus_property(obs_properties_t *props, obs_data_t *settings, CameraWidget *config,
+                                obs_property_clicked_t clicked);
+int set_manualfocus(const char *value, struct gphoto_camera *camera, GPContext *context);
\ No newline at end of file
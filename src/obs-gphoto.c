@@ -1,5 +1,12 @@
 #include <obs-module.h>
 
+#include "gphoto-backend.h"
+#include "gphoto-convert.h"
+#include "gphoto-device.h"
+#include "gphoto-discovery.h"
+#include "gphoto-sizes.h"
+#include "gphoto-trace.h"
+
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE("obs-gphoto", "en-US")
 
@@ -7,7 +14,21 @@ extern struct obs_source_info capture_preview_info;
 extern struct obs_source_info timelapse_capture_info;
 
 bool obs_module_load(void) {
+    gphoto_trace_init();
+    gphoto_convert_init();
+    gphoto_backend_init();
+    gphoto_sizes_load();
+    gphoto_discovery_init();
+    gphoto_devices_init();
     obs_register_source(&capture_preview_info);
     obs_register_source(&timelapse_capture_info);
     return true;
-}
\ No newline at end of file
+}
+
+void obs_module_unload(void) {
+    gphoto_devices_free();
+    gphoto_discovery_free();
+    gphoto_sizes_free();
+    gphoto_backend_free();
+    gphoto_trace_free();
+}
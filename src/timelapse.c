@@ -1,12 +1,14 @@
-#include <magick/MagickCore.h>
+#include <time.h>
 
 #include "timelapse.h"
 #include "gphoto-utils.h"
-#if HAVE_UDEV
-#include "gphoto-udev.h"
-#endif
-
+#include "gphoto-discovery.h"
+#include "gphoto-raw.h"
+#include "gphoto-sizes.h"
+#include "gphoto-trace.h"
 
+/* Event polls that brought nothing are this far apart. */
+#define TIMELAPSE_POLL_INTERVAL 50000000ULL
 
 static const char *timelapse_getname(void *vptr) {
     UNUSED_PARAMETER(vptr);
@@ -15,6 +17,138 @@ static const char *timelapse_getname(void *vptr) {
 
 static void timelapse_defaults(obs_data_t *settings) {
     obs_data_set_default_int(settings, "interval", 30);
+    obs_data_set_default_int(settings, "max_height", 0);
+}
+
+/*
+ * Graphics thread, takes the newest decoded photo if there is one. The texture is created by the
+ * first upload, until then render shows the placeholder.
+ */
+static void timelapse_upload(struct timelapse_data *data){
+    struct gphoto_still *still = gphoto_mailbox_take(&data->mailbox);
+    uint64_t start, end;
+
+    if (!still) {
+        return;
+    }
+    start = os_gettime_ns();
+    obs_enter_graphics();
+    if (data->texture && (still->width != data->width || still->height != data->height)) {
+        gs_texture_destroy(data->texture);
+        data->texture = NULL;
+    }
+    if (data->texture) {
+        gs_texture_set_image(data->texture, still->data, still->width * 4, false);
+    } else {
+        data->texture = gs_texture_create(still->width, still->height, GS_BGRA, 1,
+                                          (const uint8_t **)&still->data, GS_DYNAMIC);
+    }
+    data->width = still->width;
+    data->height = still->height;
+    obs_leave_graphics();
+    end = os_gettime_ns();
+    gphoto_mailbox_release(&data->mailbox, still);
+    gphoto_stats_record(&data->stats, GPHOTO_STAGE_OUTPUT, end - start);
+    gphoto_trace_span("texture upload", start, end);
+}
+
+/* The largest 1/2, 1/4 or 1/8 that keeps the photo at least max_height tall, 0 keeps the full size. */
+static uint32_t timelapse_scale(uint32_t height, long long max_height){
+    uint32_t scale = 1;
+
+    while (max_height > 0 && scale < 8 && gphoto_jpeg_scaled(height, scale * 2) >= max_height) {
+        scale *= 2;
+    }
+    return scale;
+}
+
+/*
+ * Decodes a downloaded photo for the graphics thread, no bigger than the source shows it. A photo
+ * of another size, e.g. after the image format changed or a stale cached size, resizes the source
+ * and is remembered for the next start.
+ */
+static bool timelapse_decode(struct timelapse_data *data, CameraFile *cam_file){
+    struct gphoto_frame_size size = {0};
+    struct gphoto_still *still;
+    const char *file_data = NULL;
+    unsigned long file_size = 0;
+    const uint8_t *image_data;
+    size_t data_size;
+    uint64_t start, end, convert_time;
+    long long max_height;
+    uint32_t scale;
+
+    if (gp_file_get_data_and_size(cam_file, &file_data, &file_size) < GP_OK) {
+        blog(LOG_WARNING, "Can't get image data.\n");
+        return false;
+    }
+    image_data = (const uint8_t *)file_data;
+    data_size = file_size;
+
+    /* A RAW file shows its embedded JPEG preview, ImageMagick could only develop it through a slow delegate. */
+    start = gphoto_trace_now();
+    if (!gphoto_jpeg_is_jpeg(image_data, data_size) &&
+        gphoto_raw_preview((const uint8_t *)file_data, file_size, &image_data, &data_size)) {
+        gphoto_trace_end("raw preview", start);
+    }
+
+    if (!gphoto_image_size(image_data, data_size, &size.width, &size.height)) {
+        return false;
+    }
+    pthread_mutex_lock(&data->worker_mutex);
+    if (size.width != data->photo_width || size.height != data->photo_height) {
+        size.jpeg = gphoto_jpeg_is_jpeg(image_data, data_size);
+        gphoto_sizes_set(data->device->model, data->image_format, &size);
+        data->photo_width = size.width;
+        data->photo_height = size.height;
+    }
+    max_height = data->max_height;
+    pthread_mutex_unlock(&data->worker_mutex);
+
+    scale = timelapse_scale(size.height, max_height);
+    still = gphoto_mailbox_acquire(&data->mailbox, gphoto_jpeg_scaled(size.width, scale),
+                                   gphoto_jpeg_scaled(size.height, scale));
+    start = os_gettime_ns();
+    if (!gphoto_decode_still(data->decoder, image_data, data_size, scale, still->width, still->height,
+                             still->data, &convert_time)) {
+        gphoto_mailbox_release(&data->mailbox, still);
+        return false;
+    }
+    end = os_gettime_ns();
+    gphoto_stats_record_decode(&data->stats, start, end, convert_time);
+    gphoto_trace_span("decode", start, end);
+    gphoto_mailbox_post(&data->mailbox, still);
+
+    return true;
+}
+
+/* The executor only does the USB part of a job, the timelapse worker decodes what it brought back. */
+struct timelapse_job {
+    struct timelapse_data *data;
+    uint64_t queued;
+    CameraFile *cam_file;
+};
+
+static void timelapse_capture_command(void *vptr){
+    struct timelapse_job *job = vptr;
+    struct gphoto_device *device = job->data->device;
+
+    gphoto_stats_record(&job->data->stats, GPHOTO_STAGE_QUEUE_WAIT, os_gettime_ns() - job->queued);
+    if (gp_file_new(&job->cam_file) < GP_OK) {
+        blog(LOG_WARNING, "Can't create a camera file for the photo.\n");
+        job->cam_file = NULL;
+    } else if (!gphoto_capture(device->camera, device->context, job->cam_file, &job->data->stats)) {
+        gp_file_free(job->cam_file);
+        job->cam_file = NULL;
+    }
+}
+
+/* Called with the worker mutex held. */
+static void timelapse_request_capture(struct timelapse_data *data){
+    if (data->worker_started) {
+        data->capture_requested = true;
+        pthread_cond_signal(&data->worker_cond);
+    }
 }
 
 static bool test_capture_callback(obs_properties_t *props, obs_property_t *prop, void *vptr){
@@ -22,13 +156,21 @@ static bool test_capture_callback(obs_properties_t *props, obs_property_t *prop,
     UNUSED_PARAMETER(props);
     struct timelapse_data *data = vptr;
 
-    pthread_mutex_lock(&data->camera_mutex);
-    gphoto_capture(data->camera, data->gp_context, data->width, data->height, data->texture_data);
-    pthread_mutex_unlock(&data->camera_mutex);
+    pthread_mutex_lock(&data->worker_mutex);
+    timelapse_request_capture(data);
+    pthread_mutex_unlock(&data->worker_mutex);
 
-    obs_enter_graphics();
-    gs_texture_set_image(data->texture, data->texture_data, data->width * 4, false);
-    obs_leave_graphics();
+    return TRUE;
+}
+
+static bool timelapse_stats_refresh(obs_properties_t *props, obs_property_t *prop, void *vptr){
+    UNUSED_PARAMETER(prop);
+    UNUSED_PARAMETER(props);
+    struct timelapse_data *data = vptr;
+    obs_data_t *settings = obs_source_get_settings(data->source);
+
+    gphoto_stats_update_settings(&data->stats, settings);
+    obs_data_release(settings);
 
     return TRUE;
 }
@@ -39,13 +181,9 @@ static void capture_hotkey_pressed(void *vptr, obs_hotkey_id id, obs_hotkey_t *k
     struct timelapse_data *data = vptr;
     uint64_t delta_time = os_gettime_ns() - data->last_capture_time;
     if(pressed && delta_time >= 500000000 && obs_source_active(data->source)) {
-        pthread_mutex_lock(&data->camera_mutex);
-        gphoto_capture(data->camera, data->gp_context, data->width, data->height, data->texture_data);
-        pthread_mutex_unlock(&data->camera_mutex);
-
-        obs_enter_graphics();
-        gs_texture_set_image(data->texture, data->texture_data, data->width * 4, false);
-        obs_leave_graphics();
+        pthread_mutex_lock(&data->worker_mutex);
+        timelapse_request_capture(data);
+        pthread_mutex_unlock(&data->worker_mutex);
         data->last_capture_time = os_gettime_ns();
     }
 }
@@ -66,17 +204,28 @@ static bool timelapse_interval_changed(obs_properties_t *props, obs_property_t *
     return true;
 }
 
+static bool timelapse_max_height_selected(obs_properties_t *props, obs_property_t *prop, obs_data_t *settings){
+    UNUSED_PARAMETER(props);
+    UNUSED_PARAMETER(prop);
+    obs_data_set_string(settings, "changed", "max_height");
+
+    return true;
+}
+
 static obs_properties_t *timelapse_properties(void *vptr){
     struct timelapse_data *data = vptr;
 
     obs_properties_t *props = obs_properties_create();
     obs_data_t *settings = obs_source_get_settings(data->source);
+    CameraList *cameras = NULL;
 
-    int cam_count = gp_list_count(data->cam_list);
+    gp_list_new(&cameras);
+    gphoto_discovery_list(cameras);
+    int cam_count = gp_list_count(cameras);
     if(cam_count > 0) {
         obs_property_t *cam_list = obs_properties_add_list(props, "camera_name", obs_module_text("Camera"),
                                                            OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
-        property_cam_list(data->cam_list, cam_list);
+        property_cam_list(cameras, cam_list);
         obs_property_set_modified_callback(cam_list, timelapse_camera_selected);
 
 
@@ -84,123 +233,250 @@ static obs_properties_t *timelapse_properties(void *vptr){
                                                           0, 100000, 1);
         obs_property_set_modified_callback(interval, timelapse_interval_changed);
 
-        if (data->camera) {
+        obs_property_t *max_height = obs_properties_add_list(props, "max_height", obs_module_text("Photo size"),
+                                                             OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+        obs_property_list_add_int(max_height, obs_module_text("Full size"), 0);
+        obs_property_list_add_int(max_height, "2160p", 2160);
+        obs_property_list_add_int(max_height, "1440p", 1440);
+        obs_property_list_add_int(max_height, "1080p", 1080);
+        obs_property_list_add_int(max_height, "720p", 720);
+        obs_property_set_modified_callback(max_height, timelapse_max_height_selected);
+
+        obs_property_t *status = obs_properties_add_text(props, "status", obs_module_text("Status"),
+                                                         OBS_TEXT_DEFAULT);
+        obs_property_set_enabled(status, false);
+        obs_data_set_string(settings, "status", obs_module_text(
+                gphoto_connection_state_name(gphoto_connection_state(&data->connection))));
+
+        if (gphoto_connection_lock_streaming(&data->connection)) {
+            struct gphoto_device *device = data->device;
+            CameraWidget *config;
+
             obs_properties_add_button(props, "test_capture", obs_module_text("Test Capture"), test_capture_callback);
-            pthread_mutex_lock(&data->camera_mutex);
+            config = gphoto_device_config_lock(device);
             create_obs_property_from_camera_config(props, settings, obs_module_text("Image Format"),
-                                                   data->camera, data->gp_context, "imageformat");
+                                                   config, "imageformat");
             create_obs_property_from_camera_config(props, settings, obs_module_text("Shutter Speed"),
-                                                   data->camera, data->gp_context, "shutterspeed");
-            create_obs_property_from_camera_config(props, settings, obs_module_text("Aperture"),
-                                                   data->camera, data->gp_context, "aperture");
-            create_obs_property_from_camera_config(props, settings, obs_module_text("ISO"),
-                                                   data->camera, data->gp_context, "iso");
+                                                   config, "shutterspeed");
+            create_obs_property_from_camera_config(props, settings, obs_module_text("Aperture"), config, "aperture");
+            create_obs_property_from_camera_config(props, settings, obs_module_text("ISO"), config, "iso");
             create_obs_property_from_camera_config(props, settings, obs_module_text("White balance"),
-                                                   data->camera, data->gp_context, "whitebalance");
+                                                   config, "whitebalance");
             create_obs_property_from_camera_config(props, settings, obs_module_text("Picture style"),
-                                                   data->camera, data->gp_context, "picturestyle");
-            pthread_mutex_unlock(&data->camera_mutex);
+                                                   config, "picturestyle");
+            gphoto_device_config_unlock(device);
+            gphoto_connection_unlock(&data->connection);
+
+            create_stats_property(props, settings, &data->stats, timelapse_stats_refresh);
         }
     }
 
+    gp_list_free(cameras);
     obs_data_release(settings);
 
     return props;
 }
 
-static void timelapse_init(void *vptr) {
+struct timelapse_init_call {
+    struct timelapse_data *data;
+    bool cached;
+};
+
+/* Runs on the executor. */
+static void timelapse_init_command(void *vptr) {
+    struct timelapse_init_call *call = vptr;
+    struct timelapse_data *data = call->data;
+    struct gphoto_frame_size size;
+    char *image_format;
+    uint32_t scale;
+
+    image_format = gphoto_camera_config_string(data->device->camera, "imageformat", data->device->context);
+    if (!image_format) {
+        image_format = bstrdup("default");
+    }
+    call->cached = gphoto_sizes_get(data->device->model, image_format, &size);
+
+    pthread_mutex_lock(&data->worker_mutex);
+    if (call->cached) {
+        /* No shutter actuation just to learn the size, the first photo corrects a stale one. */
+        scale = timelapse_scale(size.height, data->max_height);
+        data->width = gphoto_jpeg_scaled(size.width, scale);
+        data->height = gphoto_jpeg_scaled(size.height, scale);
+        data->photo_width = size.width;
+        data->photo_height = size.height;
+    }
+    data->image_format = image_format;
+    pthread_mutex_unlock(&data->worker_mutex);
+}
+
+/* Waits between event polls that brought nothing, a capture request or stop wakes it early. */
+static void timelapse_worker_wait(struct timelapse_data *data, uint64_t deadline){
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(deadline / 1000000000ULL);
+    ts.tv_nsec = (long)(deadline % 1000000000ULL);
+    pthread_cond_timedwait(&data->worker_cond, &data->worker_mutex, &ts);
+}
+
+static void timelapse_poll_command(void *vptr);
+
+/*
+ * Owns the timelapse: asks the executor for photos and events and decodes what comes back, so
+ * the graphics thread only ever uploads a finished photo. Photos the user asks for go ahead of the
+ * live view, those of the interval only ahead of the routine polls.
+ */
+static void *timelapse_worker(void *vptr){
     struct timelapse_data *data = vptr;
-    CameraFile *cam_file = NULL;
-    CameraFilePath camera_file_path;
-    const char *image_data = NULL;
-    unsigned long data_size = NULL;
-    Image *image = NULL;
-    ImageInfo *image_info = AcquireImageInfo();
-    ExceptionInfo *exception = AcquireExceptionInfo();
-
-    if (gp_file_new(&cam_file) < GP_OK) {
-        blog(LOG_WARNING, "What???\n");
-    } else {
-        if (gp_camera_by_name(&data->camera, data->camera_name, data->cam_list, data->gp_context) < GP_OK) {
-            blog(LOG_WARNING, "Can't get camera.\n");
+    struct timelapse_job job;
+    uint64_t now, due, last_capture = os_gettime_ns();
+    enum gphoto_priority priority;
+    bool capture;
+
+    gphoto_trace_thread_name("timelapse worker");
+    pthread_mutex_lock(&data->worker_mutex);
+    while (!data->worker_stop) {
+        now = os_gettime_ns();
+        due = data->interval > 0 ? last_capture + (uint64_t)data->interval * 1000000000ULL : UINT64_MAX;
+        capture = data->capture_requested || now >= due;
+        priority = data->capture_requested ? GPHOTO_PRIORITY_USER : GPHOTO_PRIORITY_CAPTURE;
+        data->capture_requested = false;
+        pthread_mutex_unlock(&data->worker_mutex);
+
+        job.data = data;
+        job.queued = os_gettime_ns();
+        job.cam_file = NULL;
+        if (capture) {
+            gphoto_device_call(data->device, priority, timelapse_capture_command, &job);
+            last_capture = os_gettime_ns();
         } else {
-            if (gp_camera_init(data->camera, data->gp_context) < GP_OK) {
-                blog(LOG_WARNING, "Can't init camera.\n");
-            } else {
-                if (gp_camera_capture(data->camera, GP_CAPTURE_IMAGE, &camera_file_path, data->gp_context) < GP_OK) {
-                    blog(LOG_WARNING, "Can't capture photo.\n");
-                } else {
-                    if (gp_camera_file_get(data->camera, camera_file_path.folder, camera_file_path.name,
-                                           GP_FILE_TYPE_NORMAL, cam_file, data->gp_context) < GP_OK) {
-                        blog(LOG_WARNING, "Can't get photo from camera.\n");
-                    } else {
-                        if (gp_file_get_data_and_size(cam_file, &image_data, &data_size) < GP_OK) {
-                            blog(LOG_WARNING, "Can't get image data.\n");
-                        } else {
-                            gp_camera_file_delete(data->camera, camera_file_path.folder, camera_file_path.name,
-                                                  data->gp_context);
-                            image = BlobToImage(image_info, image_data, data_size, exception);
-                            if (exception->severity != UndefinedException) {
-                                CatchException(exception);
-                                blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *) exception->severity);
-                                exception->severity = UndefinedException;
-                            } else {
-                                data->width = (uint32_t) image->magick_columns;
-                                data->height = (uint32_t) image->magick_rows;
-
-                                data->texture_data = malloc(data->width * data->height * 4);
-
-                                ExportImagePixels(image, 0, 0, data->width, data->height, "BGRA", CharPixel,
-                                                  data->texture_data,
-                                                  exception);
-                                if (exception->severity != UndefinedException) {
-                                    CatchException(exception);
-                                    blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *) exception->severity);
-                                    exception->severity = UndefinedException;
-                                } else {
-                                    obs_enter_graphics();
-                                    data->texture = gs_texture_create(data->width, data->height, GS_BGRA, 1,
-                                                                      &data->texture_data,
-                                                                      GS_DYNAMIC);
-                                    obs_leave_graphics();
-                                    goto exit;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+            gphoto_device_call(data->device, GPHOTO_PRIORITY_POLL, timelapse_poll_command, &job);
+        }
+        if (job.cam_file) {
+            timelapse_decode(data, job.cam_file);
+            gp_file_free(job.cam_file);
+        }
+
+        pthread_mutex_lock(&data->worker_mutex);
+        if (!capture && !job.cam_file && !data->worker_stop && !data->capture_requested) {
+            now = os_gettime_ns();
+            timelapse_worker_wait(data, now + TIMELAPSE_POLL_INTERVAL < due ? now + TIMELAPSE_POLL_INTERVAL : due);
         }
     }
+    pthread_mutex_unlock(&data->worker_mutex);
 
-    data->width = 0;
-    data->height = 0;
-    obs_enter_graphics();
-    data->texture = gs_texture_create(data->width, data->height, GS_BGRA, 1, NULL, GS_DYNAMIC);
-    obs_leave_graphics();
+    return NULL;
+}
+
+/* The worker has stopped and no command is queued any more. */
+static void timelapse_terminate(struct timelapse_data *data){
+    struct gphoto_still *still;
 
-    exit:
-    if(image_data){
-        free(image_data);
+    if (data->device) {
+        gphoto_device_close(data->device);
+        data->device = NULL;
     }
-    if(image_info){
-        DestroyImageInfo(image_info);
+    bfree(data->image_format);
+    data->image_format = NULL;
+    data->photo_width = 0;
+    data->photo_height = 0;
+
+    /* A photo of the old connection is not shown any more. */
+    still = gphoto_mailbox_take(&data->mailbox);
+    if (still) {
+        gphoto_mailbox_release(&data->mailbox, still);
     }
-    if(image){
-        DestroyImageList(image);
+    obs_enter_graphics();
+    gs_texture_destroy(data->texture);
+    data->texture = NULL;
+    obs_leave_graphics();
+}
+
+/* Connection worker: the camera is shared with every other source on it, the stills go between their commands. */
+static bool timelapse_connect(void *vptr){
+    struct timelapse_data *data = vptr;
+    struct timelapse_init_call init = {.data = data};
+    struct timelapse_job job = {.data = data};
+    char *camera_name = gphoto_connection_get_string(&data->connection, &data->camera_name);
+    bool connected = false;
+
+    /* Without udev a camera plugged in later is only found by another scan. */
+    if (!gphoto_discovery_has(camera_name)) {
+        gphoto_discovery_refresh();
     }
-    if(exception){
-        DestroyExceptionInfo(exception);
+
+    /* The worker and the commands use the model of the device, it stays while connected. */
+    data->device = gphoto_device_open(camera_name);
+    bfree(camera_name);
+    if (data->device) {
+        gphoto_stats_reset(&data->stats);
+        gphoto_device_call(data->device, GPHOTO_PRIORITY_USER, timelapse_init_command, &init);
+        connected = init.cached;
+        if (!connected) {
+            /* The first photo tells the size, decoded here since the worker isn't running yet. */
+            job.queued = os_gettime_ns();
+            gphoto_device_call(data->device, GPHOTO_PRIORITY_USER, timelapse_capture_command, &job);
+            if (job.cam_file) {
+                connected = timelapse_decode(data, job.cam_file);
+                gp_file_free(job.cam_file);
+            }
+        }
+        if (connected && data->autofocus) {
+            gphoto_device_set_autofocus(data->device, true);
+        }
+        if (connected) {
+            data->worker_stop = false;
+            /* Queued ahead of the worker's first poll, photos taken from now on are kept for it. */
+            gphoto_device_watch_files(data->device, true);
+            data->worker_started = pthread_create(&data->worker, NULL, timelapse_worker, data) == 0;
+            if (!data->worker_started) {
+                blog(LOG_WARNING, "%s: can't start the timelapse thread.\n", obs_source_get_name(data->source));
+                gphoto_device_watch_files(data->device, false);
+            }
+            connected = data->worker_started;
+        }
     }
+    obs_source_update_properties(data->source);
+
+    return connected;
 }
 
-static void timelapse_terminate(void *vptr){
+/* Connection worker. The worker is stopped first, the commands queued before still use the device. */
+static void timelapse_disconnect(void *vptr){
     struct timelapse_data *data = vptr;
 
-    gp_camera_exit(data->camera, data->gp_context);
-    gp_camera_free(data->camera);
-    data->camera = NULL;
-    free(data->texture_data);
+    if (data->worker_started) {
+        pthread_mutex_lock(&data->worker_mutex);
+        data->worker_stop = true;
+        pthread_cond_signal(&data->worker_cond);
+        pthread_mutex_unlock(&data->worker_mutex);
+        pthread_join(data->worker, NULL);
+        pthread_mutex_lock(&data->worker_mutex);
+        data->worker_started = false;
+        data->capture_requested = false;
+        pthread_mutex_unlock(&data->worker_mutex);
+        gphoto_device_watch_files(data->device, false);
+    }
+    if (data->device) {
+        gphoto_device_flush(data->device);
+    }
+    timelapse_terminate(data);
+}
+
+struct timelapse_format_change {
+    struct timelapse_data *data;
+    char *format;
+};
+
+/* The next photo tells the size for the new format. */
+static void timelapse_format_command(void *vptr){
+    struct timelapse_format_change *change = vptr;
+    struct timelapse_data *data = change->data;
+
+    pthread_mutex_lock(&data->worker_mutex);
+    bfree(data->image_format);
+    data->image_format = change->format;
+    pthread_mutex_unlock(&data->worker_mutex);
+    bfree(change);
 }
 
 static void timelapse_update(void *vptr, obs_data_t *settings){
@@ -209,161 +485,131 @@ static void timelapse_update(void *vptr, obs_data_t *settings){
     const char *changed = obs_data_get_string(settings, "changed");
 
     if (strcmp(changed, "camera") == 0) {
-        data->camera_name = obs_data_get_string(settings, "camera_name");
-        if (data->source->active) {
-            timelapse_terminate(data);
-            pthread_mutex_lock(&data->camera_mutex);
-            timelapse_init(data);
-            pthread_mutex_unlock(&data->camera_mutex);
-            obs_source_update_properties(data->source);
-            if(data->autofocus) {
-                pthread_mutex_lock(&data->camera_mutex);
-                set_autofocus(data->camera, data->gp_context);
-                pthread_mutex_unlock(&data->camera_mutex);
-            }
+        gphoto_connection_set_string(&data->connection, &data->camera_name,
+                                     obs_data_get_string(settings, "camera_name"));
+        if (strcmp(data->camera_name, "") == 0) {
+            gphoto_connection_close(&data->connection);
+        } else if (obs_source_showing(data->source)) {
+            gphoto_connection_open(&data->connection);
+            gphoto_connection_restart(&data->connection);
         }
     }
 
     if(strcmp(changed, "interval") == 0){
+        pthread_mutex_lock(&data->worker_mutex);
         data->interval = obs_data_get_int(settings, "interval");
+        pthread_cond_signal(&data->worker_cond);
+        pthread_mutex_unlock(&data->worker_mutex);
+    }
+
+    if(strcmp(changed, "max_height") == 0){
+        /* Applies from the next photo on. */
+        pthread_mutex_lock(&data->worker_mutex);
+        data->max_height = obs_data_get_int(settings, "max_height");
+        pthread_mutex_unlock(&data->worker_mutex);
     }
 
     if (strcmp(changed, "autofocus") == 0) {
         data->autofocus = obs_data_get_bool(settings, "autofocusdrive");
-        if(data->autofocus) {
-            pthread_mutex_lock(&data->camera_mutex);
-            set_autofocus(data->camera, data->gp_context);
-            pthread_mutex_unlock(&data->camera_mutex);
-        }else{
-            pthread_mutex_lock(&data->camera_mutex);
-            cancel_autofocus(data->camera, data->gp_context);
-            pthread_mutex_unlock(&data->camera_mutex);
+        if (gphoto_connection_lock_streaming(&data->connection)) {
+            gphoto_device_set_autofocus(data->device, data->autofocus);
+            gphoto_connection_unlock(&data->connection);
         }
     }
 
     if (strcmp(changed, "manualfocus") == 0) {
         const char *manual_focus = obs_data_get_string(settings, "manualfocus");
-        pthread_mutex_lock(&data->camera_mutex);
-        set_manualfocus(manual_focus, data->camera, data->gp_context);
-        pthread_mutex_unlock(&data->camera_mutex);
+        if (gphoto_connection_lock_streaming(&data->connection)) {
+            gphoto_device_set_manualfocus(data->device, manual_focus);
+            gphoto_connection_unlock(&data->connection);
+        }
     }
 
     if (strcmp(changed, "auto_prop") == 0) {
-        pthread_mutex_lock(&data->camera_mutex);
-        set_camera_config(settings, data->camera, data->gp_context);
-        pthread_mutex_unlock(&data->camera_mutex);
+        if (gphoto_connection_lock_streaming(&data->connection)) {
+            const char *name = obs_data_get_string(settings, "auto_prop");
+
+            gphoto_device_set_config(data->device, settings, name);
+            if (strcmp(name, "imageformat") == 0) {
+                struct timelapse_format_change *change = bzalloc(sizeof(struct timelapse_format_change));
+
+                /* Queued behind the write, photos taken before it still belong to the old format. */
+                change->data = data;
+                change->format = bstrdup(obs_data_get_string(settings, "imageformat"));
+                gphoto_device_submit(data->device, GPHOTO_PRIORITY_USER, timelapse_format_command, change);
+            }
+            gphoto_connection_unlock(&data->connection);
+        }
     }
 }
 
-#if HAVE_UDEV
 static void timelapse_camera_added(void *vptr, calldata_t *calldata) {
-    UNUSED_PARAMETER(calldata);
     struct timelapse_data *data = vptr;
-    int i, count;
-    const char *camera_name;
-    if(!data->camera){
-        pthread_mutex_lock(&data->camera_mutex);
-        gphoto_cam_list(data->cam_list, data->gp_context);
-        count = gp_list_count(data->cam_list);
-        for(i=0; i<count; i++){
-            gp_list_get_name(data->cam_list, i, &camera_name);
-            if (strcmp(camera_name, data->camera_name) == 0) {
-                timelapse_init(data);
-                pthread_mutex_unlock(&data->camera_mutex);
-                obs_source_update_properties(data->source);
-                if(data->autofocus) {
-                    pthread_mutex_lock(&data->camera_mutex);
-                    set_autofocus(data->camera, data->gp_context);
-                    pthread_mutex_unlock(&data->camera_mutex);
-                }
-                return;
-            }
-        }
-        pthread_mutex_unlock(&data->camera_mutex);
+
+    if (gphoto_connection_string_is(&data->connection, &data->camera_name, calldata_string(calldata, "model"))) {
+        gphoto_connection_retry(&data->connection);
     }
+    obs_source_update_properties(data->source);
 }
 
 static void timelapse_camera_removed(void *vptr, calldata_t *calldata) {
-    UNUSED_PARAMETER(calldata);
     struct timelapse_data *data = vptr;
-    int i, count;
-    const char *camera_name;
-    if(data->camera){
-        pthread_mutex_lock(&data->camera_mutex);
-        gphoto_cam_list(data->cam_list, data->gp_context);
-        pthread_mutex_unlock(&data->camera_mutex);
-        count = gp_list_count(data->cam_list);
-        for(i=0; i<count; i++){
-            gp_list_get_name(data->cam_list, i, &camera_name);
-            if (strcmp(camera_name, data->camera_name) == 0) {
-                pthread_mutex_unlock(&data->camera_mutex);
-                return;
-            }
-        }
-        timelapse_terminate(data);
-        obs_source_update_properties(data->source);
+
+    if (gphoto_connection_string_is(&data->connection, &data->camera_name, calldata_string(calldata, "model")) &&
+        gphoto_connection_state(&data->connection) == GPHOTO_CONNECTION_STREAMING) {
+        /* Retries until the camera is back or the attempts run out, camera_added wakes it up again. */
+        gphoto_connection_restart(&data->connection);
     }
+    obs_source_update_properties(data->source);
 }
-#endif
 
 static void timelapse_show(void *vptr) {
     struct timelapse_data *data = vptr;
-    if (strcmp(data->camera_name, "") != 0) {
-        if (!data->source->active && !data->camera) {
-            timelapse_terminate(data);
-            pthread_mutex_lock(&data->camera_mutex);
-            timelapse_init(data);
-            pthread_mutex_unlock(&data->camera_mutex);
-            obs_source_update_properties(data->source);
-            if(data->autofocus) {
-                pthread_mutex_lock(&data->camera_mutex);
-                set_autofocus(data->camera, data->gp_context);
-                pthread_mutex_unlock(&data->camera_mutex);
-            }
-        }
-    }else{
-        data->width = 0;
-        data->height = 0;
-        obs_enter_graphics();
-        data->texture = gs_texture_create(data->width, data->height, GS_BGRA, 1, NULL, GS_DYNAMIC);
-        obs_leave_graphics();
+    /* Runs on the video thread. */
+    if (!gphoto_connection_string_is(&data->connection, &data->camera_name, "")) {
+        gphoto_connection_open(&data->connection);
     }
 }
 
 static void timelapse_hide(void *vptr) {
     struct timelapse_data *data = vptr;
-    if(data->source->active) {
-        timelapse_terminate(data);
-    }
+    gphoto_connection_close(&data->connection);
 }
 
 static void *timelapse_create(obs_data_t *settings, obs_source_t *source){
     struct timelapse_data *data = bzalloc(sizeof(struct timelapse_data));
+    const uint8_t grey[4] = {0x20, 0x20, 0x20, 0xFF};
+    const uint8_t *placeholder = grey;
 
-    pthread_mutex_init(&data->camera_mutex, NULL);
+    pthread_condattr_t attr;
 
-    data->source = source;
-    data->gp_context = gp_context_new();
+    pthread_mutex_init(&data->worker_mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&data->worker_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    data->decoder = gphoto_jpeg_decoder_create();
 
-    gp_list_new(&data->cam_list);
-    gphoto_cam_list(data->cam_list, data->gp_context);
+    data->source = source;
 
-    data->camera_name = obs_data_get_string(settings, "camera_name");
+    data->camera_name = bstrdup(obs_data_get_string(settings, "camera_name"));
     data->interval = obs_data_get_int(settings, "interval");
+    data->max_height = obs_data_get_int(settings, "max_height");
     data->autofocus = obs_data_get_bool(settings, "autofocusdrive");
-    data->time_elapsed = 0;
 
     data->capture_key = obs_hotkey_register_source(source, "timelapse.capture",
                                                    obs_module_text("Capture hotkey"), capture_hotkey_pressed, data);
     data->last_capture_time = os_gettime_ns();
 
-#if HAVE_UDEV
-    gphoto_init_udev();
-    signal_handler_t *sh = gphoto_get_udev_signalhandler();
+    obs_enter_graphics();
+    data->placeholder = gs_texture_create(1, 1, GS_BGRA, 1, &placeholder, 0);
+    obs_leave_graphics();
+
+    gphoto_connection_init(&data->connection, source, timelapse_connect, timelapse_disconnect, NULL, data);
 
-    signal_handler_connect(sh, "device_added", &timelapse_camera_added, data);
-    signal_handler_connect(sh, "device_removed", &timelapse_camera_removed, data);
-#endif
+    signal_handler_t *sh = gphoto_discovery_signalhandler();
+    signal_handler_connect(sh, "camera_added", timelapse_camera_added, data);
+    signal_handler_connect(sh, "camera_removed", timelapse_camera_removed, data);
 
     return data;
 }
@@ -371,26 +617,23 @@ static void *timelapse_create(obs_data_t *settings, obs_source_t *source){
 static void timelapse_destroy(void *vptr) {
     struct timelapse_data *data = vptr;
 
-    if(data->source->active){
-        timelapse_terminate(data);
-    }
+    signal_handler_t *sh = gphoto_discovery_signalhandler();
+    signal_handler_disconnect(sh, "camera_added", timelapse_camera_added, data);
+    signal_handler_disconnect(sh, "camera_removed", timelapse_camera_removed, data);
+
+    gphoto_connection_free(&data->connection);
+    bfree(data->camera_name);
 
-    pthread_mutex_destroy(&data->camera_mutex);
-    gp_context_unref(data->gp_context);
-    gp_list_free(data->cam_list);
+    gphoto_mailbox_free(&data->mailbox);
+    gphoto_jpeg_decoder_destroy(data->decoder);
+    pthread_cond_destroy(&data->worker_cond);
+    pthread_mutex_destroy(&data->worker_mutex);
 
     obs_enter_graphics();
-    gs_texture_destroy(data->texture);
-    data->texture = NULL;
+    gs_texture_destroy(data->placeholder);
+    data->placeholder = NULL;
     obs_leave_graphics();
 
-    signal_handler_t *sh = gphoto_get_udev_signalhandler();
-
-    signal_handler_disconnect(sh, "device_added", timelapse_camera_added, data);
-    signal_handler_disconnect(sh, "device_removed", timelapse_camera_removed, data);
-
-    gphoto_unref_udev();
-
     bfree(vptr);
 }
 
@@ -406,93 +649,66 @@ static uint32_t timelapse_getheight(void *vptr) {
 
 static void timelapse_render(void *vptr, gs_effect_t *effect) {
     struct timelapse_data *data = vptr;
+    /* Until the first photo arrives the last known size is filled with grey. */
+    gs_texture_t *texture = data->texture ? data->texture : data->placeholder;
 
+    if (!data->width || !data->height) {
+        return;
+    }
     gs_reset_blend_state();
-    gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), data->texture);
-    gs_draw_sprite(data->texture, 0, data->width, data->height);
+    gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), texture);
+    gs_draw_sprite(texture, 0, data->width, data->height);
 }
 
-static void timelapse_tick(void *vptr, float seconds) {
-    struct timelapse_data *data = vptr;
-    void *event_data;
+/* Runs on the executor at the lowest priority. A new photo on the camera is downloaded for the worker. */
+static void timelapse_poll_command(void *vptr) {
+    struct timelapse_job *job = vptr;
+    struct gphoto_device *device = job->data->device;
+    void *event_data = NULL;
     CameraEventType evtype;
     CameraFilePath *path;
-    CameraFile *cam_file = NULL;
-    const char *image_data = NULL;
-    unsigned long data_size = NULL;
-    Image *image = NULL;
-    ImageInfo *image_info = AcquireImageInfo();
-    ExceptionInfo *exception = AcquireExceptionInfo();
-
-    if(data->camera){
-        pthread_mutex_lock(&data->camera_mutex);
-        data->time_elapsed += seconds;
-        if (data->time_elapsed >= data->interval && data->interval > 0) {
-            gphoto_capture(data->camera, data->gp_context, data->width, data->height, data->texture_data);
-
-            obs_enter_graphics();
-            gs_texture_set_image(data->texture, data->texture_data, data->width * 4, false);
-            obs_leave_graphics();
-
-            data->time_elapsed = 0;
+    uint64_t start, end;
+
+    /* Nothing else runs on the camera while this waits, a running live view only gets a quick look. */
+    start = gphoto_trace_now();
+    if (gphoto_device_wait_for_event(device, gphoto_device_watched(device) ? 0 : 100, &evtype, &event_data) < GP_OK) {
+        evtype = GP_EVENT_TIMEOUT;
+    }
+    gphoto_trace_end("wait for event", start);
+    path = event_data;
+    if (evtype == GP_EVENT_FILE_ADDED && path) {
+        if (gp_file_new(&job->cam_file) < GP_OK) {
+            blog(LOG_WARNING, "Can't create a camera file for the photo.\n");
+            job->cam_file = NULL;
         } else {
-            gp_camera_wait_for_event(data->camera, 100, &evtype, &event_data, data->gp_context);
-            path = event_data;
-            if (evtype == GP_EVENT_FILE_ADDED) {
-                if (gp_file_new(&cam_file) < GP_OK) {
-                    blog(LOG_WARNING, "What???\n");
-                } else {
-                    if (gp_camera_file_get(data->camera, path->folder, path->name,
-                                           GP_FILE_TYPE_NORMAL, cam_file, data->gp_context) < GP_OK) {
-                        blog(LOG_WARNING, "Can't get photo from camera.\n");
-                    } else {
-                        if (gp_file_get_data_and_size(cam_file, &image_data, &data_size) < GP_OK) {
-                            blog(LOG_WARNING, "Can't get image data.\n");
-                        } else {
-                            gp_camera_file_delete(data->camera, path->folder, path->name, data->gp_context);
-                            image = BlobToImage(image_info, image_data, data_size, exception);
-                            if (exception->severity != UndefinedException) {
-                                CatchException(exception);
-                                blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *) exception->severity);
-                                exception->severity = UndefinedException;
-                            } else {
-                                ExportImagePixels(image, 0, 0, (const size_t) data->width,
-                                                  (const size_t) data->height,
-                                                  "BGRA", CharPixel, data->texture_data,
-                                                  exception);
-                                if (exception->severity != UndefinedException) {
-                                    CatchException(exception);
-                                    blog(LOG_WARNING, "ImageMagic error: %s.\n", (char *) exception->severity);
-                                    exception->severity = UndefinedException;
-                                } else {
-                                    obs_enter_graphics();
-                                    gs_texture_set_image(data->texture, data->texture_data, data->width * 4, false);
-                                    obs_leave_graphics();
-                                }
-                            }
-                        }
-                    }
-                }
+            start = os_gettime_ns();
+            if (gphoto_camera_file_get(device->camera, path->folder, path->name,
+                                       GP_FILE_TYPE_NORMAL, job->cam_file, device->context) < GP_OK) {
+                blog(LOG_WARNING, "Can't get photo from camera.\n");
+                gp_file_free(job->cam_file);
+                job->cam_file = NULL;
+            } else {
+                gphoto_camera_file_delete(device->camera, path->folder, path->name, device->context);
+                end = os_gettime_ns();
+                gphoto_stats_record(&job->data->stats, GPHOTO_STAGE_FETCH, end - start);
+                gphoto_trace_span("download", start, end);
             }
         }
-        pthread_mutex_unlock(&data->camera_mutex);
     }
 
-    if (image_data) {
-        free(image_data);
-    }
-    if (image_info) {
-        DestroyImageInfo(image_info);
-    }
-    if (image) {
-        DestroyImageList(image);
-    }
-    if (exception) {
-        DestroyExceptionInfo(exception);
-    }
-    if (cam_file) {
-        //TODO: SIGSEGV here, can't understand why!
-        //gp_file_free(cam_file);
+    /* Event data is allocated by the backend for the caller. */
+    free(event_data);
+}
+
+/* Only swaps in a photo the worker finished, the graphics thread never waits for the camera. */
+static void timelapse_tick(void *vptr, float seconds) {
+    UNUSED_PARAMETER(seconds);
+    struct timelapse_data *data = vptr;
+
+    gphoto_trace_thread_name("graphics");
+    timelapse_upload(data);
+    if (gphoto_connection_state(&data->connection) == GPHOTO_CONNECTION_STREAMING) {
+        gphoto_stats_log(&data->stats, obs_source_get_name(data->source), os_gettime_ns());
     }
 }
 
@@ -2,25 +2,47 @@
 #include <obs-internal.h>
 #include <gphoto2/gphoto2-camera.h>
 
+#include "gphoto-connection.h"
+#include "gphoto-device.h"
+#include "gphoto-jpeg.h"
+#include "gphoto-mailbox.h"
+#include "gphoto-stats.h"
+
 struct timelapse_data {
     /* settings */
-    const char *camera_name;
+    char *camera_name;
     long long int interval;
+    long long int max_height;
     bool autofocus;
 
     /* internal data */
     obs_source_t *source;
-    pthread_mutex_t camera_mutex;
+    struct gphoto_connection connection;
+    pthread_mutex_t worker_mutex;
+    struct gphoto_stats stats;
 
+    /* Shown size and texture, changed by the graphics thread once connected. */
     uint32_t width;
     uint32_t height;
-    uint8_t *texture_data;
     gs_texture_t *texture;
-    float time_elapsed;
+    gs_texture_t *placeholder;
+
+    /* Photos decoded by the worker, the tick uploads the newest. */
+    struct gphoto_mailbox mailbox;
+    struct gphoto_jpeg_decoder *decoder;
+    uint32_t photo_width;
+    uint32_t photo_height;
+
+    /* Set by the connection worker, the timelapse worker only runs while it is open. */
+    struct gphoto_device *device;
 
-    CameraList *cam_list;
-    Camera *camera;
-    GPContext *gp_context;
+    /* Under the worker mutex. */
+    char *image_format;
+    pthread_t worker;
+    pthread_cond_t worker_cond;
+    bool worker_started;
+    bool worker_stop;
+    bool capture_requested;
 
     obs_hotkey_id capture_key;
     uint64_t last_capture_time;